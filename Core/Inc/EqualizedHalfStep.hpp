@@ -0,0 +1,91 @@
+/*
+ * EqualizedHalfStep.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_EQUALIZEDHALFSTEP_HPP_
+#define INC_EQUALIZEDHALFSTEP_HPP_
+#include "main.h"
+
+#include <Hbridge.hpp>
+#include <array>
+#include <cstdint>
+
+// high side pins and low side duties (LowA, LowC, LowB, LowD) of a pattern
+struct PwmPhase {
+  uint32_t high;
+  std::array<uint16_t, 4> low;
+};
+
+// the phases on in a pattern are chopped at full duty, or at twoPhaseDuty
+// when two of them are on.
+template <std::size_t N>
+constexpr std::array<PwmPhase, N>
+toPwmTable(const std::array<ExcitingACBD, N> &pulses, uint16_t fullDuty,
+           uint16_t twoPhaseDuty) {
+  std::array<PwmPhase, N> table{};
+  for (std::size_t i = 0; i < N; ++i) {
+    ExcitingACBD p = pulses[i];
+    bool two = ((p & (ExA | ExC)) != 0) && ((p & (ExB | ExD)) != 0);
+    uint16_t duty = two ? twoPhaseDuty : fullDuty;
+    table[i].high = hbridgePins(static_cast<HiACBDLoACBD>((p & 0xf) << 4));
+    table[i].low = {(p & ExA) ? duty : uint16_t{0},
+                    (p & ExC) ? duty : uint16_t{0},
+                    (p & ExB) ? duty : uint16_t{0},
+                    (p & ExD) ? duty : uint16_t{0}};
+  }
+  return table;
+}
+
+// no high side on with the opposite low side chopped
+template <std::size_t N>
+constexpr bool isShootThroughFree(const std::array<PwmPhase, N> &table) {
+  for (const PwmPhase &p : table) {
+    uint32_t low = (p.low[0] ? LowA_Pin : 0) | (p.low[1] ? LowC_Pin : 0) |
+                   (p.low[2] ? LowB_Pin : 0) | (p.low[3] ? LowD_Pin : 0);
+    if (!isShootThroughFree(p.high | low)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Torque equalized half-stepping.
+//
+// The two-phase positions (AB, BC, ...) give sqrt(2) times the torque of
+// the single-phase ones (A, B, ...), so the HalfStepPulses are played out
+// with the two-phase ones chopped at 1/sqrt(2) duty on the low side switches
+// (TIM2 CH1 - CH4 outputs, as microstepping does).
+class EqualizedHalfStep {
+public:
+  // 20kHz PWM at 24MHz
+  const static constexpr uint16_t PwmPeriod = SYSCLK_FREQUENCY / 20000;
+  const static constexpr uint16_t TwoPhaseDuty = PwmPeriod * 707 / 1000;
+  // one half step at most in a PWM period
+  const static constexpr uint32_t MaxHalfStepRate =
+      SYSCLK_FREQUENCY / PwmPeriod;
+  //
+  // A coil is off for a half step before its current changes direction,
+  // so the high side is never turned on while its opposite low side
+  // still has the duty of the last PWM period.
+  static void excite(TIM_TypeDef *tim, int32_t step) {
+    const PwmPhase &p = Phases[step & 7];
+    tim->CCR1 = p.low[0]; // LowA
+    tim->CCR2 = p.low[1]; // LowC
+    tim->CCR3 = p.low[2]; // LowB
+    tim->CCR4 = p.low[3]; // LowD
+    Hbridge_GPIO_Port->BSRR = ((HighPins & ~p.high) << 16) | p.high;
+  }
+
+private:
+  const static constexpr uint32_t HighPins = hbridgePins(0xf0);
+  const static constexpr std::array<PwmPhase, 8> Phases =
+      toPwmTable(HalfStepPulses, PwmPeriod, TwoPhaseDuty);
+  static_assert(isShootThroughFree(Phases), "shoot-through in Phases");
+};
+
+#endif /* INC_EQUALIZEDHALFSTEP_HPP_ */
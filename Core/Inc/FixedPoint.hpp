@@ -0,0 +1,143 @@
+/*
+ * FixedPoint.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_FIXEDPOINT_HPP_
+#define INC_FIXEDPOINT_HPP_
+
+#include <cstdint>
+
+// integer square root, rounded down
+constexpr uint32_t isqrt(uint64_t x) {
+  uint64_t root = 0;
+  uint64_t bit = uint64_t{1} << 62;
+  for (int i = 0; i < 32; ++i) {
+    if (x >= root + bit) {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return static_cast<uint32_t>(root);
+}
+
+// Q16.16 fixed point number.
+//
+// Cortex-M0+ has neither FPU nor divider, and its MULS gives only the low
+// 32 bits of a product. Multiplication is built from four 16 x 16 bit
+// products, division and square root are shift-and-subtract loops of
+// a fixed number of iterations, so none of them calls the run time library
+// and each takes the same time whatever the operands are.
+// Results out of range wrap around (multiplication) or saturate (division).
+// All of them are constexpr, so that FixedPoint.cpp checks them against
+// double at compile time.
+class Fixed {
+public:
+  const static constexpr uint8_t FractionBits = 16;
+  const static constexpr int32_t One = int32_t{1} << FractionBits;
+  //
+  constexpr Fixed() = default;
+  constexpr static Fixed fromInt(int32_t i) { return Fixed(i * One); }
+  constexpr static Fixed fromRaw(int32_t raw) { return Fixed(raw); }
+  // numerator / denominator rounded, meant for constants at compile time
+  constexpr static Fixed fromRatio(int32_t numerator, int32_t denominator) {
+    return Fixed(static_cast<int32_t>(
+        (int64_t{numerator} * One * 2 + denominator) / (2 * denominator)));
+  }
+  //
+  constexpr int32_t raw() const { return value; }
+  // rounded down
+  constexpr int32_t integer() const { return value >> FractionBits; }
+  // fraction part in 1/scale, rounded down
+  constexpr uint32_t fraction(uint32_t scale) const {
+    return (static_cast<uint32_t>(value & (One - 1)) * scale) >> FractionBits;
+  }
+  //
+  constexpr Fixed operator+(Fixed b) const { return Fixed(value + b.value); }
+  constexpr Fixed operator-(Fixed b) const { return Fixed(value - b.value); }
+  constexpr Fixed operator-() const { return Fixed(-value); }
+  constexpr Fixed operator*(Fixed b) const {
+    return Fixed(multiply(value, b.value));
+  }
+  constexpr Fixed operator/(Fixed b) const {
+    return Fixed(divide(value, b.value));
+  }
+  constexpr Fixed &operator+=(Fixed b) { return *this = *this + b; }
+  constexpr Fixed &operator-=(Fixed b) { return *this = *this - b; }
+  constexpr Fixed &operator*=(Fixed b) { return *this = *this * b; }
+  constexpr Fixed &operator/=(Fixed b) { return *this = *this / b; }
+  //
+  constexpr bool operator==(Fixed b) const { return value == b.value; }
+  constexpr bool operator!=(Fixed b) const { return value != b.value; }
+  constexpr bool operator<(Fixed b) const { return value < b.value; }
+  constexpr bool operator<=(Fixed b) const { return value <= b.value; }
+  constexpr bool operator>(Fixed b) const { return value > b.value; }
+  constexpr bool operator>=(Fixed b) const { return value >= b.value; }
+  //
+  constexpr Fixed abs() const { return Fixed(value < 0 ? -value : value); }
+  constexpr Fixed reciprocal() const { return Fixed(divide(One, value)); }
+  // 0 for negative numbers
+  constexpr Fixed sqrt() const {
+    if (value <= 0) {
+      return Fixed();
+    }
+    // sqrt(x * 2^16) = sqrt(x) * 2^8, which is sqrt in Q16.16
+    return Fixed(static_cast<int32_t>(isqrt(uint64_t{uint32_t(value)} << 16)));
+  }
+
+private:
+  int32_t value = 0;
+  constexpr explicit Fixed(int32_t raw) : value(raw) {}
+  //
+  constexpr static uint32_t magnitude(int32_t x) {
+    return (x < 0) ? 0u - static_cast<uint32_t>(x) : static_cast<uint32_t>(x);
+  }
+  constexpr static int32_t withSign(uint32_t x, bool negative) {
+    return static_cast<int32_t>(negative ? 0u - x : x);
+  }
+  // (a * b) >> 16 with 16 x 16 bit products, which MULS makes in full.
+  constexpr static int32_t multiply(int32_t a, int32_t b) {
+    uint32_t x = magnitude(a);
+    uint32_t y = magnitude(b);
+    uint32_t xh = x >> 16, xl = x & 0xffff;
+    uint32_t yh = y >> 16, yl = y & 0xffff;
+    uint32_t product =
+        ((xh * yh) << 16) + xh * yl + xl * yh + ((xl * yl) >> 16);
+    return withSign(product, (a ^ b) < 0);
+  }
+  // (a << 16) / b by restoring division, one quotient bit per iteration.
+  constexpr static int32_t divide(int32_t a, int32_t b) {
+    bool negative = (a ^ b) < 0;
+    uint32_t d = magnitude(b);
+    uint32_t n = magnitude(a);
+    uint32_t r = n >> 16; // upper 16 bits of the 48-bit dividend
+    if (d == 0 || r >= d) {
+      return negative ? INT32_MIN : INT32_MAX;
+    }
+    uint32_t low = n << 16;
+    uint32_t q = 0;
+    for (int i = 0; i < 32; ++i) {
+      bool carry = (r >> 31) != 0;
+      r = (r << 1) | (low >> 31);
+      low <<= 1;
+      q <<= 1;
+      if (carry || r >= d) {
+        r -= d;
+        q |= 1;
+      }
+    }
+    if (q > INT32_MAX) {
+      return negative ? INT32_MIN : INT32_MAX;
+    }
+    return withSign(q, negative);
+  }
+};
+
+#endif /* INC_FIXEDPOINT_HPP_ */
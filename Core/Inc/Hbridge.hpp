@@ -0,0 +1,180 @@
+/*
+ * Hbridge.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_HBRIDGE_HPP_
+#define INC_HBRIDGE_HPP_
+#include "main.h"
+
+#include <array>
+#include <cstdint>
+
+// all of the two H-brigdes pins are on GPIOA (see main.h)
+#define Hbridge_GPIO_Port GPIOA
+
+using ExcitingACBD = uint8_t;
+constexpr ExcitingACBD ExA = 0b1000;
+constexpr ExcitingACBD ExC = 0b0100;
+constexpr ExcitingACBD ExB = 0b0010;
+constexpr ExcitingACBD ExD = 0b0001;
+
+using HiACBDLoACBD = uint8_t;
+constexpr HiACBDLoACBD fromExcitingACBD(ExcitingACBD acbd) {
+  return (acbd & 0xf) << 4 | (acbd & 0xf);
+}
+
+// GPIOA pins of the switches in a pattern
+constexpr uint32_t hbridgePins(HiACBDLoACBD hiloACBD) {
+  return ((hiloACBD & (ExA << 4)) ? HighA_Pin : 0) |
+         ((hiloACBD & (ExC << 4)) ? HighC_Pin : 0) |
+         ((hiloACBD & (ExB << 4)) ? HighB_Pin : 0) |
+         ((hiloACBD & (ExD << 4)) ? HighD_Pin : 0) |
+         ((hiloACBD & ExA) ? LowA_Pin : 0) |
+         ((hiloACBD & ExC) ? LowC_Pin : 0) |
+         ((hiloACBD & ExB) ? LowB_Pin : 0) |
+         ((hiloACBD & ExD) ? LowD_Pin : 0);
+}
+constexpr uint32_t HbridgeAllPins = hbridgePins(0xff);
+
+// GPIOA BSRR words of a pattern
+struct PhaseWord {
+  uint32_t off; // reset bits of the switches to be turned off
+  uint32_t on;  // set bits of the switches to be turned on
+};
+constexpr PhaseWord toPhaseWord(HiACBDLoACBD hiloACBD) {
+  uint32_t pins = hbridgePins(hiloACBD);
+  return {(HbridgeAllPins & ~pins) << 16, pins};
+}
+
+template <std::size_t N>
+constexpr std::array<PhaseWord, N>
+toPhaseTable(const std::array<ExcitingACBD, N> &pulses) {
+  std::array<PhaseWord, N> table{};
+  for (std::size_t i = 0; i < N; ++i) {
+    table[i] = toPhaseWord(fromExcitingACBD(pulses[i]));
+  }
+  return table;
+}
+
+// Wave drive (one phase on)
+constexpr std::array<ExcitingACBD, 4> WavePulses{
+    ExA, // A
+    ExB, // B
+    ExC, // C
+    ExD, // D
+};
+// Full-step drive (two phases on)
+constexpr std::array<ExcitingACBD, 4> FullStepPulses{
+    ExA | ExB, // AB
+    ExB | ExC, // BC
+    ExC | ExD, // CD
+    ExD | ExA, // DA
+};
+// Half-step drive
+constexpr std::array<ExcitingACBD, 8> HalfStepPulses{
+    ExA,       // A
+    ExA | ExB, // AB
+    ExB,       // B
+    ExB | ExC, // BC
+    ExC,       // C
+    ExC | ExD, // CD
+    ExD,       // D
+    ExD | ExA, // DA
+};
+constexpr std::array<PhaseWord, 4> WavePhases = toPhaseTable(WavePulses);
+constexpr std::array<PhaseWord, 4> FullStepPhases =
+    toPhaseTable(FullStepPulses);
+constexpr std::array<PhaseWord, 8> HalfStepPhases =
+    toPhaseTable(HalfStepPulses);
+
+// patterns of wave or full-step drive at the half-step positions.
+// first is the half step of table[0], and the last pattern passed
+// is kept in between.
+constexpr std::array<PhaseWord, 8>
+toHalfStepTable(const std::array<PhaseWord, 4> &table, std::size_t first) {
+  std::array<PhaseWord, 8> halfSteps{};
+  for (std::size_t i = 0; i < 8; ++i) {
+    halfSteps[i] = table[((i + 8 - first) / 2) & 3];
+  }
+  return halfSteps;
+}
+constexpr std::array<PhaseWord, 8> WaveByHalfStep =
+    toHalfStepTable(WavePhases, 0);
+constexpr std::array<PhaseWord, 8> FullStepByHalfStep =
+    toHalfStepTable(FullStepPhases, 1);
+
+// short brake = turn ON all lower side switch.
+constexpr PhaseWord ShortBrakePhase = toPhaseWord(0b00001111);
+
+// a bridge leg is the high side of a coil end and the low side of the other
+// end, which short the supply when both are on:
+//   HighA-LowC, HighC-LowA, HighB-LowD, HighD-LowB
+constexpr bool isShootThroughFree(uint32_t pins) {
+  auto both = [pins](uint32_t high, uint32_t low) {
+    return (pins & high) != 0 && (pins & low) != 0;
+  };
+  return !both(HighA_Pin, LowC_Pin) && !both(HighC_Pin, LowA_Pin) &&
+         !both(HighB_Pin, LowD_Pin) && !both(HighD_Pin, LowB_Pin);
+}
+template <std::size_t N>
+constexpr bool isShootThroughFree(const std::array<PhaseWord, N> &table) {
+  for (const PhaseWord &w : table) {
+    if (!isShootThroughFree(w.on)) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(isShootThroughFree(WavePhases), "shoot-through in WavePhases");
+static_assert(isShootThroughFree(FullStepPhases),
+              "shoot-through in FullStepPhases");
+static_assert(isShootThroughFree(HalfStepPhases),
+              "shoot-through in HalfStepPhases");
+static_assert(isShootThroughFree(WaveByHalfStep),
+              "shoot-through in WaveByHalfStep");
+static_assert(isShootThroughFree(FullStepByHalfStep),
+              "shoot-through in FullStepByHalfStep");
+static_assert(isShootThroughFree(ShortBrakePhase.on),
+              "shoot-through in ShortBrakePhase");
+
+// dead time between turning off and on the switches:
+// the turn-off time of the MOSFETs (with the gate drive) and margin.
+constexpr uint32_t HbridgeTurnOffNanoseconds = 800;
+// rounded up, also for SYSCLK below 1MHz (MSI ranges)
+constexpr uint32_t HbridgeDeadTimeCycles = static_cast<uint32_t>(
+    (uint64_t{HbridgeTurnOffNanoseconds} * SYSCLK_FREQUENCY + 999999999) /
+    1000000000);
+
+// busy wait of the dead time at least.
+// a loop of SUBS (1) and BNE (2) is 3 cycles without wait states,
+// and only gets longer from the flash.
+constexpr uint32_t HbridgeDeadTimeLoops = (HbridgeDeadTimeCycles + 2) / 3;
+// SUBS from 0 wraps around, and BNE would run 2^32 loops
+static_assert(HbridgeDeadTimeLoops >= 1, "dead time loop runs once at least");
+
+static inline void hbridgeDeadTime() {
+  uint32_t loops = HbridgeDeadTimeLoops;
+  asm volatile("1: subs %0, #1\n"
+               "   bne 1b"
+               : "+l"(loops)
+               :
+               : "cc");
+}
+
+static inline void excitingCoil(const PhaseWord &phase) {
+  if ((Hbridge_GPIO_Port->ODR & HbridgeAllPins) == phase.on) {
+    return;
+  }
+  Hbridge_GPIO_Port->BSRR = phase.off;
+  hbridgeDeadTime();
+  Hbridge_GPIO_Port->BSRR = phase.on;
+}
+
+static inline void shortBrake() { excitingCoil(ShortBrakePhase); }
+
+#endif /* INC_HBRIDGE_HPP_ */
@@ -0,0 +1,57 @@
+/*
+ * JogGenerator.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_JOGGENERATOR_HPP_
+#define INC_JOGGENERATOR_HPP_
+#include "main.h"
+
+#include <RampGenerator.hpp>
+#include <atomic>
+#include <cstdint>
+
+// Step interval generator of the continuous move (jog).
+//
+// The main loop sets a signed target velocity at any time, and the speed
+// follows it step by step at the constant acceleration: v^2 changes by 2a
+// a step. To reverse, the speed comes down to the slowest rate of the timer,
+// rests for a moment and goes up again in the other direction.
+class JogGenerator {
+public:
+  using Ticks = RampGenerator::Ticks;
+  // main loop side, maxRate: steps/s, accel: steps/s^2
+  void setLimits(uint32_t maxRate, uint32_t accel);
+  // steps/s, the sign is the direction (as Rotation)
+  void setTarget(int32_t velocity) {
+    target.store(velocity, std::memory_order_relaxed);
+  }
+  int32_t targetVelocity() const {
+    return target.load(std::memory_order_relaxed);
+  }
+  // step ISR side: direction and interval before the next step,
+  // false while resting.
+  bool next(int8_t &direction, Ticks &interval);
+  // the slowest cruise interval (0: no limit), as RampGenerator::setCruise
+  void setCruise(Ticks ticks) { cruiseSquare = RampGenerator::squareOf(ticks); }
+  bool isResting() const { return dir == 0; }
+
+private:
+  const static constexpr uint32_t SlowestRate =
+      RampGenerator::TimerClock / RampGenerator::MaxInterval + 1;
+  //
+  std::atomic<int32_t> target{0};
+  uint32_t maxSquare = 0; // (steps/s)^2
+  uint32_t twoAccel = 0;  // 2a of v^2 = u^2 + 2as
+  uint32_t cruiseSquare = UINT32_MAX;
+  // current motion
+  int8_t dir = 0;      // 0: resting
+  uint32_t square = 0; // (steps/s)^2
+  uint32_t rate = 0;   // steps/s
+};
+
+#endif /* INC_JOGGENERATOR_HPP_ */
@@ -0,0 +1,88 @@
+/*
+ * Microstep.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_MICROSTEP_HPP_
+#define INC_MICROSTEP_HPP_
+#include "main.h"
+
+#include <Hbridge.hpp>
+#include <array>
+#include <cstdint>
+
+// sin(x) for 0 <= x <= pi/2, only used at compile time
+constexpr double microstepSine(double x) {
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 10; ++n) {
+    term = -term * x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+// duty of sin(90 degrees * i / N), i = 0 .. N
+template <uint32_t N>
+constexpr std::array<uint16_t, N + 1> microstepDuty(uint16_t period) {
+  std::array<uint16_t, N + 1> table{};
+  for (uint32_t i = 0; i <= N; ++i) {
+    double s = microstepSine(3.14159265358979323846 / 2 * i / N);
+    table[i] = static_cast<uint16_t>(s * period + 0.5);
+  }
+  return table;
+}
+
+// Sine/cosine microstepping on the low side switches.
+//
+// LowA, LowC, LowB, LowD (PA0 - PA3) are TIM2 CH1 - CH4 outputs (AF2)
+// and chop the coil current, while the high side switches select
+// the direction of current of each coil.
+//   coil A/C = cos(theta), coil B/D = sin(theta)
+// Resolution is the number of microsteps in a full step (90 degrees),
+// so that an electrical cycle is 4 * Resolution microsteps.
+template <uint32_t Resolution> class Microstep {
+  static_assert(Resolution >= 8 && Resolution <= 32 &&
+                    (Resolution & (Resolution - 1)) == 0,
+                "Resolution has to be 8, 16 or 32");
+
+public:
+  // 20kHz PWM at 24MHz
+  const static constexpr uint16_t PwmPeriod = SYSCLK_FREQUENCY / 20000;
+  const static constexpr uint32_t PerHalfStep = Resolution / 2;
+  // one microstep at most in a PWM period
+  const static constexpr uint32_t MaxHalfStepRate =
+      SYSCLK_FREQUENCY / PwmPeriod / PerHalfStep;
+  //
+  static void excite(TIM_TypeDef *tim, uint32_t index) {
+    uint32_t k = index & (Resolution - 1);
+    uint32_t quadrant = (index / Resolution) & 3;
+    uint16_t x = Duty[k];
+    uint16_t y = Duty[Resolution - k];
+    // magnitudes and signs of cos(theta) and sin(theta)
+    uint16_t ac = (quadrant & 1) ? x : y;
+    uint16_t bd = (quadrant & 1) ? y : x;
+    bool toC = (quadrant == 1 || quadrant == 2);
+    bool toD = (quadrant >= 2);
+    // A coil passes through zero before the current changes direction,
+    // so the high side is never turned on while its opposite low side
+    // still has the duty of the last PWM period.
+    uint32_t on = (ac ? (toC ? HighC_Pin : HighA_Pin) : 0) |
+                  (bd ? (toD ? HighD_Pin : HighB_Pin) : 0);
+    tim->CCR1 = toC ? 0 : ac; // LowA
+    tim->CCR2 = toC ? ac : 0; // LowC
+    tim->CCR3 = toD ? 0 : bd; // LowB
+    tim->CCR4 = toD ? bd : 0; // LowD
+    Hbridge_GPIO_Port->BSRR = ((HighPins & ~on) << 16) | on;
+  }
+
+private:
+  const static constexpr uint32_t HighPins = hbridgePins(0xf0);
+  const static constexpr std::array<uint16_t, Resolution + 1> Duty =
+      microstepDuty<Resolution>(PwmPeriod);
+};
+
+#endif /* INC_MICROSTEP_HPP_ */
@@ -0,0 +1,73 @@
+/*
+ * MovePlanner.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_MOVEPLANNER_HPP_
+#define INC_MOVEPLANNER_HPP_
+#include "main.h"
+
+#include <MoveQueue.hpp>
+#include <SkipBands.hpp>
+#include <array>
+#include <cstdint>
+
+// Look-ahead junction speed planner in front of the MoveQueue.
+//
+// The last few segments are held back in a window, and their entry and
+// exit speeds are planned with v^2 = u^2 + 2as twice:
+//   backward from the end of the window, which is assumed to stand still,
+//   forward from the exit speed of the segment queued last.
+// Segments in the same direction are joined at the lower of their peak
+// rates, while a dwell or a change of direction stops the motor.
+// A segment goes to the queue when the window is full or when a stop
+// behind it has settled its speeds; the ISR never sees them changing.
+// The ISR runs a segment at speed into the next one only when that one is
+// queued already, and flush() brings the end of a program to rest.
+// Peak and junction speeds are kept out of the skip bands.
+class MovePlanner {
+public:
+  const static constexpr std::size_t Lookahead = 4;
+  //
+  MovePlanner(MoveQueue &q, int32_t position = 0)
+      : queue(q), planned(position) {}
+  // plans the segment after the ones planned before.
+  // false: no room for it now, plan it again later.
+  bool plan(const MoveSegment &segment);
+  // queues the segments held back, the last one coming to rest.
+  // false: no room for all of them now, flush again later.
+  bool flush();
+  // position at the end of the segments planned so far
+  int32_t plannedPosition() const { return planned; }
+  // resonances, set them before planning
+  SkipBands &skipBands() { return bands; }
+  const SkipBands &skipBands() const { return bands; }
+
+private:
+  struct Staged {
+    MoveSegment segment;
+    uint32_t steps;
+    uint16_t maxEntry; // junction speed with the segment before
+  };
+  MoveQueue &queue;
+  SkipBands bands;
+  std::array<Staged, Lookahead> window{};
+  uint8_t count = 0;
+  int32_t planned;
+  // the segment planned last
+  int8_t lastDirection = 0; // 0: not to be joined
+  uint16_t lastPeakRate = 0;
+  uint16_t lastDwell = 0;
+  // exit speed of the segment queued last
+  uint16_t queuedExit = 0;
+  //
+  void recalculate();
+  void commitSettled();
+  bool commitFirst();
+};
+
+#endif /* INC_MOVEPLANNER_HPP_ */
@@ -0,0 +1,34 @@
+/*
+ * MoveQueue.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_MOVEQUEUE_HPP_
+#define INC_MOVEQUEUE_HPP_
+#include "main.h"
+
+#include <RampGenerator.hpp>
+#include <SpscQueue.hpp>
+#include <cstdint>
+
+// a move from the current position to the target,
+// then standing still for the dwell.
+struct MoveSegment {
+  int32_t target;    // position at the end of move (steps)
+  uint16_t peakRate; // steps/s
+  uint16_t dwell;    // ms
+  uint16_t accel;    // steps/s^2
+  RampGenerator::Profile profile;
+  // junction speeds given by the MovePlanner
+  uint16_t entryRate; // steps/s
+  uint16_t exitRate;  // steps/s
+};
+
+// 4 segments of 16 bytes take 68 bytes of the 2KB RAM.
+using MoveQueue = SpscQueue<MoveSegment, 4>;
+
+#endif /* INC_MOVEQUEUE_HPP_ */
@@ -0,0 +1,52 @@
+/*
+ * PeriodBuffer.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_PERIODBUFFER_HPP_
+#define INC_PERIODBUFFER_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+// Double buffered period of the step timer.
+//
+// The main loop requests a new period at any time, and the step ISR takes
+// it at the update event, where ARR preload hands it to TIM2 at the next
+// update (the DMA sequencer takes it at a refill of its buffer instead).
+// So no step is cut short or stretched by a write in the middle of
+// a period. Requests coming faster than the updates are coalesced:
+// the last one is applied and the ones it replaced are counted.
+class PeriodBuffer {
+public:
+  // main loop side
+  void request(uint16_t ticks) {
+    back = ticks;
+    requests.store(requests.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+  uint32_t coalescedCount() const { return coalesced; }
+  // step ISR side, true with a new period
+  bool take(uint16_t &ticks) {
+    uint16_t r = requests.load(std::memory_order_acquire);
+    if (r == taken) {
+      return false;
+    }
+    coalesced = coalesced + static_cast<uint16_t>(r - taken - 1);
+    taken = r;
+    ticks = back;
+    return true;
+  }
+
+private:
+  volatile uint16_t back = 0;
+  std::atomic<uint16_t> requests{0}; // written by the main loop
+  uint16_t taken = 0;                // written by the step ISR
+  volatile uint32_t coalesced = 0;
+};
+
+#endif /* INC_PERIODBUFFER_HPP_ */
@@ -0,0 +1,126 @@
+/*
+ * RampGenerator.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_RAMPGENERATOR_HPP_
+#define INC_RAMPGENERATOR_HPP_
+#include "main.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Step interval generator for the TIM2 step timer.
+//
+// Trapezoidal speed profile with the real-time approximation of
+// D. Austin, "Generate stepper-motor speed profiles in real time" (2005).
+// Each interval is derived from the previous one with a single integer
+// division, so no floating point is needed while the motor is running.
+//
+// S-curve profile blends the squared speed with smoothstep 3x^2 - 2x^3 over
+// the distance of the ramp, so the acceleration rises from and falls back to
+// zero and the jerk stays bounded. The peak acceleration of the curve is
+// the given one, which makes the ramp 1.5 times longer than trapezoidal.
+//
+// A move may enter and leave at a speed, so that moves are joined
+// without stopping at their junction.
+//
+// Table profile plays a ramp built at compile time (see RampTable.hpp),
+// one table load per step, from rest to rest.
+//
+// The cruise may be lowered while running. Trapezoidal and S-curve ramps
+// come to it at their acceleration, keep the speed at the end of move,
+// and go back to the planned one when it is lifted. Table ramps play as
+// they are built.
+class RampGenerator {
+public:
+  enum class Profile : uint8_t { Trapezoidal, SCurve, Table };
+  // timer ticks between two steps (TIM2 is a 16-bit timer)
+  using Ticks = uint16_t;
+  //
+  const static constexpr uint32_t TimerClock = SYSCLK_FREQUENCY;
+  const static constexpr Ticks MaxInterval = 0xffff;
+  const static constexpr Ticks MinInterval = 100;
+  // S-curve keeps (steps/s)^2 in 32 bits: 60000 steps/s
+  const static constexpr Ticks MinSquareInterval = 400;
+  //
+  // steps: length of move, maxRate: steps/s, accel: steps/s^2 (below 2^28)
+  // entryRate, exitRate: steps/s at both ends of move (60000 at most)
+  bool start(uint32_t steps, uint32_t maxRate, uint32_t accel,
+             Profile p = Profile::Trapezoidal, uint32_t entryRate = 0,
+             uint32_t exitRate = 0);
+  // steps: length of move, the table ramps up from and down to rest
+  template <std::size_t N>
+  bool start(uint32_t steps, const std::array<Ticks, N> &table) {
+    return start(steps, table.data(), N);
+  }
+  // the slowest cruise interval from the next one on (0: as planned),
+  // kept over the moves that follow.
+  void setCruise(Ticks ticks);
+  // (steps/s)^2 of a cruise interval, no limit for 0
+  static uint32_t squareOf(Ticks ticks);
+  // interval in ticks before the next step
+  Ticks next() {
+    if (profile == Profile::Table) {
+      // step index from the nearest end of move
+      uint32_t k = std::min(total - remaining, remaining - 1);
+      --remaining;
+      return table[std::min(k, tableLast)];
+    }
+    Ticks ticks = interval >> FractionBits;
+    if (--remaining != 0) {
+      advance();
+    }
+    return ticks;
+  }
+  bool isRunning() const { return remaining != 0; }
+  uint32_t remainingSteps() const { return remaining; }
+
+private:
+  // intervals are held in 1/256 ticks to keep the rounding error small
+  const static constexpr uint8_t FractionBits = 8;
+  //
+  Profile profile = Profile::Trapezoidal;
+  uint32_t remaining = 0; // intervals not handed out yet
+  uint32_t interval = 0;  // current interval
+  // trapezoidal
+  uint32_t n = 0;    // ramp index (steps needed to reach this speed)
+  uint32_t nEnd = 0; // ramp index at the end of the move
+  uint32_t minInterval = 0;
+  uint32_t plannedMin = 0; // minInterval of the move as planned
+  // S-curve and table
+  uint32_t total = 0;       // length of move
+  uint16_t upSteps = 0;     // length of acceleration
+  uint16_t downSteps = 0;   // length of deceleration
+  uint32_t upScale = 0;     // 2^31 / upSteps
+  uint32_t downScale = 0;   // 2^31 / downSteps
+  uint32_t entrySquare = 0; // (steps/s)^2 at the beginning of move
+  uint32_t exitSquare = 0;  // (steps/s)^2 at the end of move
+  uint32_t peakSquare = 0;  // (steps/s)^2 at the cruise
+  uint32_t twoAccel = 0;    // steepest change of the square in a step
+  uint32_t rate = 0;        // steps/s
+  // cruise asked for
+  Ticks cruiseTicks = 0;
+  uint32_t cruiseSquare = UINT32_MAX;
+  // table
+  const Ticks *table = nullptr;
+  uint32_t tableLast = 0;
+  //
+  bool start(uint32_t steps, const Ticks *ramp, std::size_t length);
+  void advance() {
+    if (profile == Profile::SCurve) {
+      advanceSCurve();
+    } else {
+      advanceTrapezoidal();
+    }
+  }
+  void advanceTrapezoidal();
+  void advanceSCurve();
+};
+
+#endif /* INC_RAMPGENERATOR_HPP_ */
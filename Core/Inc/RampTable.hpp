@@ -0,0 +1,75 @@
+/*
+ * RampTable.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_RAMPTABLE_HPP_
+#define INC_RAMPTABLE_HPP_
+#include "main.h"
+
+#include <RampGenerator.hpp>
+#include <array>
+#include <cstdint>
+
+// square root, only used at compile time
+constexpr double rampTableSqrt(double x) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  double r = (x < 1.0) ? 1.0 : x;
+  for (int i = 0; i < 64; ++i) {
+    r = (r + x / r) / 2;
+  }
+  return r;
+}
+
+// Acceleration ramp built at compile time.
+//
+// Intervals[k] is the exact time between step k and k + 1 from rest at
+// the constant acceleration:
+//   t(n) = sqrt(2n / Accel), Intervals[k] = Clock * (t(n + 1) - t(n))
+// starting at the slowest rate the 16-bit timer can make and ending at
+// MaxRate. Being constexpr, the table is placed in flash (.rodata).
+template <uint32_t Accel, uint32_t MaxRate,
+          uint32_t Clock = RampGenerator::TimerClock>
+class RampTable {
+  using Ticks = RampGenerator::Ticks;
+  static constexpr double interval(uint32_t n) {
+    return Clock * (rampTableSqrt(2.0 * (n + 1) / Accel) -
+                    rampTableSqrt(2.0 * n / Accel));
+  }
+  static constexpr uint32_t first() {
+    uint32_t n = 0;
+    while (interval(n) > RampGenerator::MaxInterval) {
+      ++n;
+    }
+    return n;
+  }
+  static constexpr std::size_t length() {
+    uint32_t n = first();
+    while (interval(n) > static_cast<double>(Clock) / MaxRate) {
+      ++n;
+    }
+    return n - first() + 1;
+  }
+  static constexpr std::array<Ticks, length()> build() {
+    std::array<Ticks, length()> table{};
+    for (std::size_t k = 0; k < table.size(); ++k) {
+      table[k] = static_cast<Ticks>(interval(first() + k) + 0.5);
+    }
+    // the last one is the cruise
+    table[table.size() - 1] = Clock / MaxRate;
+    return table;
+  }
+
+public:
+  static_assert(Clock / MaxRate >= RampGenerator::MinInterval,
+                "MaxRate is too fast for the step ISR");
+  const static constexpr std::array<Ticks, length()> Intervals = build();
+};
+
+#endif /* INC_RAMPTABLE_HPP_ */
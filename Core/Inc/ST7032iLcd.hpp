@@ -11,50 +11,112 @@
 #define INC_ST7032ILCD_HPP_
 #include "main.h"
 
+#include <SpscQueue.hpp>
 #include <array>
 #include <cstdint>
 #include <cstring>
+#include <initializer_list>
 #include <string>
 #include <vector>
 
+// The frames to the LCD are queued and sent in the I2C interrupt
+// (a master write driven on the registers), so the main loop does not wait
+// for the bus
+// unless the queue is full or it flushes, and then no longer than
+// LCD_TIMEOUT for a frame. The frame being sent is read from its queue
+// slot, which is released when the frame has gone or been given up.
 class ST7032iLcd {
 public:
+  using Callback = void (*)();
   //
   ST7032iLcd(I2C_HandleTypeDef &h, uint8_t addr = 0x3e)
       : i2c(h), i2c_address(addr) {}
   //
   bool init(uint8_t contrast = 0b100100);
+  // sent is called in the I2C interrupt after each frame.
+  void setTransmitCallback(Callback sent) { onSent = sent; }
+  bool isBusy() const { return sending || !queue.empty(); }
+  // waits (sleeping) until all the frames are sent, false on timeout
+  bool flush(uint32_t timeout = LCD_TIMEOUT);
+  uint32_t errorCount() const { return errors; }
+  // TXIS, NACKF, STOPF and the bus errors (in the I2C interrupt)
+  void interrupt();
   void setContrast(uint8_t contrast);
   //
   template <std::size_t N>
   void sendCommands(const std::array<uint8_t, N> &cmds) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_COMMAND, N, cmds.data());
+    master_transmit(I2C_LCD_CBYTE_COMMAND, N, cmds.data());
+  }
+  void sendCommands(std::initializer_list<uint8_t> cmds) {
+    master_transmit(I2C_LCD_CBYTE_COMMAND, cmds.size(), cmds.begin());
   }
   void sendCommands(const std::vector<uint8_t> &cmds) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_COMMAND, cmds.size(),
-                    cmds.data());
+    master_transmit(I2C_LCD_CBYTE_COMMAND, cmds.size(), cmds.data());
   }
   void sendCommand(uint8_t cmd) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_COMMAND, 1, &cmd);
+    master_transmit(I2C_LCD_CBYTE_COMMAND, 1, &cmd);
   }
   //
   template <std::size_t N> void sendData(const std::array<uint8_t, N> &data) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_DATA, N, data.data());
+    master_transmit(I2C_LCD_CBYTE_DATA, N, data.data());
   }
   void sendData(const std::vector<uint8_t> &data) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_DATA, data.size(),
-                    data.data());
+    master_transmit(I2C_LCD_CBYTE_DATA, data.size(), data.data());
   }
   void sendDatum(uint8_t datum) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_DATA, 1, &datum);
+    master_transmit(I2C_LCD_CBYTE_DATA, 1, &datum);
   }
   //
   void puts(const char *s) {
-    master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_DATA, std::strlen(s),
+    master_transmit(I2C_LCD_CBYTE_DATA, std::strlen(s),
                     reinterpret_cast<const uint8_t *>(s));
   }
   void putString(const std::string &s);
   //
+  // shadow of the 16x2 cells: putCells() changes the cells,
+  // and flushCells() sends only the ones changed since the last flush.
+  // (the text written otherwise is not in the shadow)
+  void putCells(uint8_t row, uint8_t column, const char *s);
+  void flushCells();
+  //
+  // Commands and data chained into one I2C write (one START), e.g.
+  //   lcd.transaction().command(0x80 | 0x40).data(codes, 16).send();
+  // Each byte has a control byte with the continuation bit (Co) and its RS,
+  // except the last run of commands or data that follows a single one.
+  // Longer ones than a frame go out in a few writes.
+  class Transaction {
+  public:
+    explicit Transaction(ST7032iLcd &l) : lcd(l) {}
+    Transaction &command(uint8_t cmd) { return add(false, cmd); }
+    Transaction &datum(uint8_t datum) { return add(true, datum); }
+    Transaction &data(const uint8_t *data, std::size_t size) {
+      for (std::size_t i = 0; i < size; ++i) {
+        add(true, data[i]);
+      }
+      return *this;
+    }
+    // queues the frames, then the transaction is empty.
+    void send();
+
+  private:
+    const static constexpr std::size_t MaxBytes = 32;
+    ST7032iLcd &lcd;
+    std::array<uint8_t, MaxBytes> bytes;
+    uint32_t dataBits = 0; // RS of the bytes
+    uint8_t count = 0;
+    //
+    Transaction &add(bool rs, uint8_t byte) {
+      if (count == MaxBytes) {
+        send();
+      }
+      dataBits |= rs ? (uint32_t{1} << count) : 0;
+      bytes[count++] = byte;
+      return *this;
+    }
+    bool isData(std::size_t i) const { return (dataBits >> i) & 1; }
+  };
+  Transaction transaction() { return Transaction(*this); }
+  //
   using Command = uint8_t;
   const static constexpr Command CmdClearDisplay = 0b00000001;
   const static constexpr Command CmdReturnHome = 0b00000010;
@@ -84,14 +146,47 @@ private:
   //
   const static constexpr uint8_t LCD_TIMEOUT = 100;
   const static constexpr uint8_t LCD_NUM_OF_ROW_CHARACTERS = 16;
+  const static constexpr uint8_t LCD_NUM_OF_ROWS = 2;
+  const static constexpr uint8_t LCD_ROW_ADDRESS_STEP = 0x40;
+  const static constexpr uint8_t LCD_NUM_OF_ICON_ADDRESSES = 16;
+  // data bytes in an I2C frame, longer ones are sent in pieces
+  const static constexpr std::size_t LCD_MAX_FRAME_DATA =
+      LCD_NUM_OF_ROW_CHARACTERS;
   //
   using CommByte = uint8_t;
   const static constexpr CommByte I2C_LCD_CBYTE_COMMAND = 0x00;
   const static constexpr CommByte I2C_LCD_CBYTE_DATA = 0x40;
   const static constexpr CommByte I2C_LCD_CBYTE_CONTINUATION = 0x80;
   //
-  static void master_transmit(I2C_HandleTypeDef &i2c, uint8_t i2c_address,
-                              CommByte cbyte, size_t size, const uint8_t *data);
+  struct Frame {
+    uint8_t size;
+    std::array<uint8_t, LCD_MAX_FRAME_DATA * 2> bytes;
+  };
+  // one frame on the bus and one to follow
+  SpscQueue<Frame, 2> queue;
+  volatile bool sending = false;
+  volatile uint32_t errors = 0;
+  volatile bool framesLost = false; // set in the I2C interrupt
+  uint8_t bytesSent = 0;            // of the frame on the bus
+  bool nacked = false;              // the frame on the bus
+  Callback onSent = nullptr;
+  //
+  std::array<uint8_t, LCD_NUM_OF_ROWS * LCD_NUM_OF_ROW_CHARACTERS> cells;
+  uint32_t dirtyCells = 0; // a bit for a cell
+  static_assert(LCD_NUM_OF_ROWS * LCD_NUM_OF_ROW_CHARACTERS <= 32,
+                "a bit for a cell");
+  // icon RAM as written last
+  std::array<uint8_t, LCD_NUM_OF_ICON_ADDRESSES> iconRam;
+  bool iconsKnown = false;
+  //
+  void master_transmit(CommByte cbyte, size_t size, const uint8_t *data);
+  void queueFrame(const Frame &frame);
+  void abandonFrame();
+  void forgetLostFrames();
+  void kick();
+  void startNext();
+  void transmitted(bool ok);
+  void resetBus();
 };
 
 #endif /* INC_ST7032ILCD_H_ */
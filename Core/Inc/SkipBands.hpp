@@ -0,0 +1,60 @@
+/*
+ * SkipBands.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_SKIPBANDS_HPP_
+#define INC_SKIPBANDS_HPP_
+
+#include <array>
+#include <cstdint>
+
+// Forbidden step rate bands (mid-band resonances of the motor).
+//
+// The motor must not run at a steady speed inside a band,
+// so a cruise or junction speed in a band is moved below it.
+// Ramps pass through the bands at their acceleration.
+class SkipBands {
+public:
+  const static constexpr std::size_t Capacity = 2;
+  // steps/s, both inclusive. false: no room or no band.
+  bool add(uint16_t low, uint16_t high) {
+    if (count == Capacity || low == 0 || low > high) {
+      return false;
+    }
+    bands[count++] = {low, high};
+    return true;
+  }
+  void clear() { count = 0; }
+  // highest rate out of the bands at or below the rate
+  uint16_t below(uint16_t rate) const {
+    // overlapping bands move the rate once each at most
+    for (std::size_t pass = 0; pass < count; ++pass) {
+      bool moved = false;
+      for (std::size_t i = 0; i < count; ++i) {
+        if (bands[i].low <= rate && rate <= bands[i].high) {
+          rate = bands[i].low - 1;
+          moved = true;
+        }
+      }
+      if (!moved) {
+        break;
+      }
+    }
+    return rate;
+  }
+
+private:
+  struct Band {
+    uint16_t low;
+    uint16_t high;
+  };
+  std::array<Band, Capacity> bands{};
+  std::size_t count = 0;
+};
+
+#endif /* INC_SKIPBANDS_HPP_ */
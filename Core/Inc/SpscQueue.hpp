@@ -0,0 +1,82 @@
+/*
+ * SpscQueue.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_SPSCQUEUE_HPP_
+#define INC_SPSCQUEUE_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer / single consumer ring buffer.
+//
+// One side (the main loop) only pushes, the other one (an ISR) only pops,
+// so each index has one writer and plain atomic loads and stores are enough.
+// Cortex-M0+ has no exclusive access instructions, but does not need them
+// here. The indexes run freely over uint8_t and N has to be a power of 2.
+template <typename T, std::size_t N> class SpscQueue {
+  static_assert(N != 0 && (N & (N - 1)) == 0, "N has to be power of 2");
+  static_assert(N <= 128, "N has to fit in the 8-bit indexes");
+
+public:
+  const static constexpr std::size_t Capacity = N;
+  // producer side
+  bool push(const T &item) {
+    uint8_t h = head.load(std::memory_order_relaxed);
+    uint8_t t = tail.load(std::memory_order_acquire);
+    if (static_cast<uint8_t>(h - t) == N) {
+      return false;
+    }
+    buffer[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    uint8_t used = h + 1 - t;
+    highWater = (used > highWater) ? used : highWater;
+    return true;
+  }
+  bool full() const { return size() == N; }
+  // consumer side
+  bool pop(T &item) {
+    uint8_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = buffer[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  // the oldest item in place, or nullptr. the producer leaves its slot
+  // alone until pop() releases it.
+  T *front() {
+    uint8_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &buffer[t & (N - 1)];
+  }
+  void pop() {
+    uint8_t t = tail.load(std::memory_order_relaxed);
+    tail.store(t + 1, std::memory_order_release);
+  }
+  // either side
+  std::size_t size() const {
+    return static_cast<uint8_t>(head.load(std::memory_order_acquire) -
+                                tail.load(std::memory_order_acquire));
+  }
+  bool empty() const { return size() == 0; }
+  // most items ever queued at once (producer side)
+  std::size_t peakSize() const { return highWater; }
+
+private:
+  std::array<T, N> buffer{};
+  std::atomic<uint8_t> head{0}; // written by the producer
+  std::atomic<uint8_t> tail{0}; // written by the consumer
+  uint8_t highWater = 0;
+};
+
+#endif /* INC_SPSCQUEUE_HPP_ */
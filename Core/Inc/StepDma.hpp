@@ -0,0 +1,90 @@
+/*
+ * StepDma.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_STEPDMA_HPP_
+#define INC_STEPDMA_HPP_
+#include "main.h"
+
+#include <Hbridge.hpp>
+#include <RampGenerator.hpp>
+#include <StepPosition.hpp>
+#include <array>
+#include <cstdint>
+
+// DMA driven step sequencer.
+//
+// Every TIM2 period is one step, and three DMA channels play it out
+// from circular buffers in RAM without any interrupt per step.
+//   TIM2_UP  (DMA1 channel 2): next period into ARR (preloaded)
+//   TIM2_CH1 (DMA1 channel 5): switches to be turned off into GPIOA BRR
+//   TIM2_CH2 (DMA1 channel 3): switches to be turned on into GPIOA BSRR
+// CCR1 and CCR2 are apart by the dead time of the H-brigdes.
+// The CPU refills a half buffer and counts its steps
+// on each half transfer of the channel 3, so the end of a move is known
+// at the end of the half buffer that has its last step.
+class StepDma {
+public:
+  using Callback = void (*)();
+  // finished is called in the DMA interrupt when a move has played out,
+  // refilling before a half buffer takes the next intervals of the ramp.
+  StepDma(TIM_HandleTypeDef &h, StepPosition &counter, volatile uint32_t &togo,
+          Callback finished = nullptr, Callback refilling = nullptr)
+      : htim(h), position(counter), stepsToGo(togo), onFinished(finished),
+        onRefilling(refilling) {}
+  //
+  void init();
+  // TIM2 CH1 and CH2 compares of the turning off and on
+  void configureCompares();
+  // ramp has to be started for this move
+  template <std::size_t N>
+  bool start(RampGenerator &r, const std::array<PhaseWord, N> &table,
+             int8_t direction) {
+    static_assert((N & (N - 1)) == 0, "size of table has to be power of 2");
+    return start(r, table.data(), N - 1, direction);
+  }
+  void stop();
+  bool isRunning() const { return running; }
+  // half and whole transfers of the channel 3 (in the DMA interrupt)
+  void interrupt();
+
+private:
+  TIM_HandleTypeDef &htim;
+  StepPosition &position;
+  volatile uint32_t &stepsToGo;
+  Callback onFinished;
+  Callback onRefilling;
+  //
+  const static constexpr std::size_t BufferSteps = 16;
+  const static constexpr std::size_t HalfSteps = BufferSteps / 2;
+  const static constexpr uint16_t OffCompare = 1;
+  // TIM2 runs at SYSCLK
+  const static constexpr uint16_t DeadTimeTicks = HbridgeDeadTimeCycles;
+  const static constexpr uint16_t OnCompare = OffCompare + DeadTimeTicks;
+  //
+  std::array<uint16_t, BufferSteps> periods;
+  std::array<uint16_t, BufferSteps> offPins;
+  std::array<uint16_t, BufferSteps> onPins;
+  //
+  RampGenerator *ramp = nullptr;
+  const PhaseWord *phases = nullptr;
+  uint8_t phaseMask = 0;
+  int8_t step = 0;
+  volatile bool running = false;
+  int32_t phaseIndex = 0; // pattern of the next step to be buffered
+  uint32_t toFill = 0;    // steps not buffered yet
+  uint16_t lastPeriod = 0;
+  uint16_t lastOnPins = 0;
+  //
+  bool start(RampGenerator &r, const PhaseWord *table, uint8_t mask,
+             int8_t direction);
+  void fill(std::size_t begin);
+  void completed(std::size_t begin);
+};
+
+#endif /* INC_STEPDMA_HPP_ */
@@ -0,0 +1,87 @@
+/*
+ * StepPosition.hpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+
+#ifndef INC_STEPPOSITION_HPP_
+#define INC_STEPPOSITION_HPP_
+
+#include <atomic>
+#include <cstdint>
+
+// 64-bit position counter of the step ISR with tear-free snapshots.
+//
+// The step ISR (or the DMA interrupt) is the only writer, and it makes
+// the sequence odd while it writes. The main loop copies the position,
+// the interval and the direction, and takes the copy when the sequence
+// was even and has not changed, else it reads again. So the readers never
+// disable the step interrupt, and the writer never waits for them.
+class StepPosition {
+public:
+  struct Snapshot {
+    int64_t position;  // half steps
+    uint32_t interval; // timer ticks of a step, 0: standing still
+    int8_t direction;  // of the last step
+    // steps/s, the sign is the direction
+    int32_t velocity(uint32_t clock) const {
+      if (interval == 0) {
+        return 0;
+      }
+      int32_t rate = static_cast<int32_t>(clock / interval);
+      return (direction < 0) ? -rate : rate;
+    }
+  };
+  // step ISR side
+  void advance(int32_t steps, uint32_t ticks) {
+    begin();
+    position += steps;
+    interval = ticks;
+    direction = (steps < 0) ? -1 : 1;
+    end();
+  }
+  void standStill() {
+    if (interval != 0) {
+      begin();
+      interval = 0;
+      end();
+    }
+  }
+  // low 32 bits for the phase of the drive and the distance of the moves,
+  // read by the writer or while it stands still.
+  int32_t low() const { return static_cast<int32_t>(position); }
+  // main loop side
+  Snapshot snapshot() const {
+    for (;;) {
+      uint32_t s = sequence.load(std::memory_order_acquire);
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      Snapshot shot{position, interval, direction};
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      if ((s & 1) == 0 && sequence.load(std::memory_order_relaxed) == s) {
+        return shot;
+      }
+    }
+  }
+
+private:
+  std::atomic<uint32_t> sequence{0};
+  int64_t position = 0;
+  uint32_t interval = 0;
+  int8_t direction = 0;
+  //
+  void begin() {
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+  }
+  void end() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    sequence.store(sequence.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+};
+
+#endif /* INC_STEPPOSITION_HPP_ */
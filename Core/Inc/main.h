@@ -75,6 +75,15 @@ void Error_Handler(void);
 #define HighD_Pin GPIO_PIN_7
 #define HighD_GPIO_Port GPIOA
 /* USER CODE BEGIN Private defines */
+/* SYSCLK configured by SystemClock_Config(): HSI16 x3 / 2 */
+#define SYSCLK_FREQUENCY 24000000UL
+
+/* DIR output of the STEP/DIR backend, STEP is TIM2 CH4 on PB1 */
+#define Dir_Pin GPIO_PIN_14
+#define Dir_GPIO_Port GPIOC
+
+/* 1: TIM2_IRQHandler() calls the step handler without HAL_TIM_IRQHandler() */
+#define USE_STEP_ISR_FAST_PATH 1
 
 /* USER CODE END Private defines */
 
@@ -54,6 +54,8 @@ void PendSV_Handler(void);
 void SysTick_Handler(void);
 void TIM2_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void DMA1_Channel2_3_IRQHandler(void);
+void I2C1_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -8,160 +8,469 @@
  */
 #include "main.h"
 
+#include <FixedPoint.hpp>
+#include <EqualizedHalfStep.hpp>
+#include <Hbridge.hpp>
+#include <JogGenerator.hpp>
+#include <Microstep.hpp>
+#include <MovePlanner.hpp>
+#include <MoveQueue.hpp>
+#include <PeriodBuffer.hpp>
+#include <RampGenerator.hpp>
+#include <RampTable.hpp>
 #include <ST7032iLcd.hpp>
+#include <StepDma.hpp>
+#include <StepPosition.hpp>
+#include <algorithm>
 #include <array>
-#include <cmath>
+#include <cstdlib>
 
 extern I2C_HandleTypeDef hi2c1;
 extern TIM_HandleTypeDef htim2;
 
 static ST7032iLcd i2c_lcd(hi2c1);
 
-// H-brigde pin class
-template <GPIO_TypeDef *PORT(), uint32_t PIN> class HbridgePin {
-public:
-  static GPIO_PinState state() {
-    if (((PORT()->ODR) & PIN) == 0) {
-      return GPIO_PIN_RESET;
-    } else {
-      return GPIO_PIN_SET;
+//
+enum class Rotation : int8_t { CW = -1, CCW = 1 };
+
+// The position counts half steps whatever the drive is,
+// and is the one of the pattern excited now.
+// Wave and full-step drives have a pattern at every other half step,
+// and keep the last one they passed in between.
+// Their patterns are the even and odd ones of the half-step table.
+
+// Wave drive (one phase on): A at 0, B at 2, ...
+constexpr std::size_t wavePattern(int32_t halfSteps) { return halfSteps & 6; }
+
+// Full-step drive (two phases on): AB at 1, BC at 3, ...
+constexpr std::size_t fullStepPattern(int32_t halfSteps) {
+  return ((halfSteps + 7) & 6) | 1;
+}
+
+// Half-step drive
+constexpr std::size_t halfStepPattern(int32_t halfSteps) {
+  return halfSteps & 7;
+}
+
+constexpr bool isPickedFromHalfStep(const std::array<PhaseWord, 8> &table,
+                                    std::size_t (*pattern)(int32_t)) {
+  for (int32_t h = 0; h < 8; ++h) {
+    if (table[h].on != HalfStepPhases[pattern(h)].on) {
+      return false;
     }
   }
-  static void turnOn() { HAL_GPIO_WritePin(PORT(), PIN, GPIO_PIN_SET); }
-  static void turnOff() { HAL_GPIO_WritePin(PORT(), PIN, GPIO_PIN_RESET); }
+  return true;
+}
+static_assert(isPickedFromHalfStep(WaveByHalfStep, wavePattern),
+              "wave drive in the half-step table");
+static_assert(isPickedFromHalfStep(FullStepByHalfStep, fullStepPattern),
+              "full-step drive in the half-step table");
+
+static StepPosition stepPosition;
+static volatile Rotation rotation = Rotation::CW;
+
+constexpr static const int32_t RightAngle = 400 / 2;
+
+// holding current of the motor standing still
+constexpr static const uint32_t HoldSettleTime = 200;   // ms
+constexpr static const uint8_t HoldCurrentPercent = 40; // %
+
+// mid-band resonance of the motor, no steady speed in it
+constexpr static const uint16_t ResonanceLow = 1150;  // steps/s
+constexpr static const uint16_t ResonanceHigh = 1300; // steps/s
+
+// speed profile of moves
+constexpr static const uint32_t MaxStepRate = 4800;       // steps/s
+constexpr static const uint32_t StepAcceleration = 24000; // steps/s^2
+// S-curve has no acceleration step at both ends of ramp,
+// so it is allowed to run harder.
+constexpr static const uint32_t SCurveAcceleration = 36000; // steps/s^2
+// MoveSegment keeps the acceleration in 16 bits
+static_assert(StepAcceleration <= UINT16_MAX &&
+                  SCurveAcceleration <= UINT16_MAX,
+              "acceleration out of MoveSegment");
+
+static RampGenerator ramp;
+static RampGenerator::Ticks cruise = 0; // taken from cruisePeriod
+static volatile uint32_t stepsToGo = 0;
+
+// the right angle hops are on the ramp built at compile time.
+using HopRamp = RampTable<StepAcceleration, MaxStepRate>;
+
+// who plays out the steps of a move
+enum class Sequencer : uint8_t { Interrupt, Dma };
+static void dmaFinished();
+static void takeCruise();
+static StepDma stepDma(htim2, stepPosition, stepsToGo, dmaFinished,
+                       takeCruise);
+
+// the step ISR chains the segments exactly,
+// the DMA sequencer ends a segment at the end of a half buffer.
+constexpr static const Sequencer DemoSequencer = Sequencer::Interrupt;
+
+// drive of the two H-brigdes,
+// or STEP/DIR pulses to an external driver IC.
+enum class Drive : uint8_t {
+  Wave,
+  FullStep,
+  HalfStep,
+  EqualizedHalfStep,
+  Microstep,
+  StepDir
 };
+static volatile Drive drive = Drive::HalfStep;
 
-// two H-brigdes port declaration
-constexpr GPIO_TypeDef *HbHighA_GPIO_Port() { return HighA_GPIO_Port; }
-constexpr GPIO_TypeDef *HbHighC_GPIO_Port() { return HighC_GPIO_Port; }
-constexpr GPIO_TypeDef *HbHighB_GPIO_Port() { return HighB_GPIO_Port; }
-constexpr GPIO_TypeDef *HbHighD_GPIO_Port() { return HighD_GPIO_Port; }
-constexpr GPIO_TypeDef *HbLowA_GPIO_Port() { return LowA_GPIO_Port; }
-constexpr GPIO_TypeDef *HbLowC_GPIO_Port() { return LowC_GPIO_Port; }
-constexpr GPIO_TypeDef *HbLowB_GPIO_Port() { return LowB_GPIO_Port; }
-constexpr GPIO_TypeDef *HbLowD_GPIO_Port() { return LowD_GPIO_Port; }
-
-// two H-brigdes pins declaration
-using HbPinHighA = HbridgePin<HbHighA_GPIO_Port, HighA_Pin>;
-using HbPinHighC = HbridgePin<HbHighC_GPIO_Port, HighC_Pin>;
-using HbPinHighB = HbridgePin<HbHighB_GPIO_Port, HighB_Pin>;
-using HbPinHighD = HbridgePin<HbHighD_GPIO_Port, HighD_Pin>;
-using HbPinLowA = HbridgePin<HbLowA_GPIO_Port, LowA_Pin>;
-using HbPinLowC = HbridgePin<HbLowC_GPIO_Port, LowC_Pin>;
-using HbPinLowB = HbridgePin<HbLowB_GPIO_Port, LowB_Pin>;
-using HbPinLowD = HbridgePin<HbLowD_GPIO_Port, LowD_Pin>;
-
-using ExcitingACBD = uint8_t;
-constexpr ExcitingACBD ExA = 0b1000;
-constexpr ExcitingACBD ExC = 0b0100;
-constexpr ExcitingACBD ExB = 0b0010;
-constexpr ExcitingACBD ExD = 0b0001;
-
-using HiACBDLoACBD = uint8_t;
-static inline HiACBDLoACBD fromExcitingACBD(ExcitingACBD acbd) {
-  return (acbd & 0xf) << 4 | (acbd & 0xf);
+constexpr static const Drive DemoDrive = Drive::HalfStep;
+
+// the drives switching over on the fly, as the gears do
+static bool isPatternDrive(Drive d) {
+  return d == Drive::Wave || d == Drive::FullStep || d == Drive::HalfStep;
 }
-//
-static inline void excitingCoil(HiACBDLoACBD hiloACBD) {
-  {
-    ExcitingACBD hi =
-        (HbPinHighA::state() ? ExA : 0) | (HbPinHighC::state() ? ExC : 0) |
-        (HbPinHighB::state() ? ExB : 0) | (HbPinHighD::state() ? ExD : 0);
-    ExcitingACBD lo =
-        (HbPinLowA::state() ? ExA : 0) | (HbPinLowC::state() ? ExC : 0) |
-        (HbPinLowB::state() ? ExB : 0) | (HbPinLowD::state() ? ExD : 0);
-    if (((hi << 4) | lo) == hiloACBD) {
+
+static void excitePosition(int32_t halfSteps) {
+  std::size_t pattern = 0;
+  switch (drive) {
+  case Drive::Wave:
+    pattern = wavePattern(halfSteps);
+    break;
+  case Drive::FullStep:
+    pattern = fullStepPattern(halfSteps);
+    break;
+  case Drive::StepDir:
+    // TIM2 has put out the STEP pulse at the update event
+    return;
+  default:
+    pattern = halfStepPattern(halfSteps);
+    break;
+  }
+  excitingCoil(HalfStepPhases[pattern]);
+}
+
+// STEP pulse of TIM2 CH4 (PWM mode 1) at the beginning of a period
+constexpr static const uint16_t StepPulseTicks =
+    RampGenerator::TimerClock / 500000; // 2us
+
+// segments of moves from the main loop to the step ISR
+static MoveQueue moveQueue;
+static MovePlanner planner(moveQueue);
+// the segments behind a junction in the window cover the stop from full
+// speed, or the planner slows down the right angles passed by.
+static_assert((MovePlanner::Lookahead - 1) * RightAngle * 2 *
+                      StepAcceleration >=
+                  MaxStepRate * MaxStepRate,
+              "window shorter than the stopping distance");
+static volatile bool moving = false; // the step ISR runs the segments
+static uint32_t dwellTicks = 0;      // timer ticks to stand still
+
+// TIM2 period while standing still
+constexpr static const uint32_t DwellPeriod =
+    RampGenerator::TimerClock / 1000; // 1ms
+
+// microstepping runs TIM2 at the PWM period
+// and advances the microsteps with a phase accumulator.
+using Microstepping = Microstep<16>;
+static uint32_t microIndex = 0;
+static uint32_t microSub = 0;
+static uint32_t microElapsed = 0;
+static uint32_t halfStepInterval = 0;
+
+// drives chopping the low side switches run TIM2 at the PWM period
+static_assert(EqualizedHalfStep::PwmPeriod == Microstepping::PwmPeriod,
+              "PWM drives share the period of TIM2");
+static bool isPwmDrive() {
+  return drive == Drive::Microstep || drive == Drive::EqualizedHalfStep;
+}
+// step rate limit of the drive
+static uint32_t maxDriveRate() {
+  switch (drive) {
+  case Drive::Microstep:
+    return Microstepping::MaxHalfStepRate;
+  case Drive::EqualizedHalfStep:
+    return EqualizedHalfStep::MaxHalfStepRate;
+  default:
+    return UINT32_MAX;
+  }
+}
+
+// continuous move at a velocity instead of the segments
+static JogGenerator jog;
+static volatile bool jogging = false;
+static volatile bool jogEnding = false; // stops when come to rest
+
+static void setRotation(Rotation r) {
+  rotation = r;
+  if (drive == Drive::StepDir) {
+    // DIR changes after the rising edge of the last STEP pulse (hold time)
+    // and an interval before the next one (setup time).
+    HAL_GPIO_WritePin(Dir_GPIO_Port, Dir_Pin,
+                      (r == Rotation::CCW) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+  }
+}
+
+static uint32_t loadedExit = 0; // steps/s, of the segment loaded last
+
+// takes the next segment out of the queue into the ramp.
+static bool loadSegment() {
+  MoveSegment segment;
+  if (!moveQueue.pop(segment)) {
+    return false;
+  }
+  // the targets wrap around with the low 32 bits of the position
+  int32_t distance = static_cast<int32_t>(
+      static_cast<uint32_t>(segment.target) -
+      static_cast<uint32_t>(stepPosition.low()));
+  setRotation((distance < 0) ? Rotation::CW : Rotation::CCW);
+  dwellTicks = segment.dwell * (RampGenerator::TimerClock / 1000);
+  // the drive and the cruise asked for cap the speeds of the segment,
+  // so that it joins the next one capped alike.
+  uint32_t rate = std::min<uint32_t>(segment.peakRate, maxDriveRate());
+  if (cruise != 0) {
+    rate = std::min(rate, RampGenerator::TimerClock / cruise);
+  }
+  // it leaves at speed only into the next segment queued already,
+  // and the next one enters at the speed this one leaves.
+  uint32_t entry = std::min<uint32_t>({segment.entryRate, rate, loadedExit});
+  uint32_t exit =
+      moveQueue.empty() ? 0 : std::min<uint32_t>(segment.exitRate, rate);
+  uint32_t steps = std::abs(distance);
+  bool started = false;
+  if (segment.profile == RampGenerator::Profile::Table && !isPwmDrive()) {
+    started = ramp.start(steps, HopRamp::Intervals);
+    exit = 0; // the table runs from rest to rest
+  } else {
+    started =
+        ramp.start(steps, rate, segment.accel, segment.profile, entry, exit);
+  }
+  stepsToGo = started ? steps : 0;
+  loadedExit = started ? exit : 0;
+  return true;
+}
+
+// holding current: standing still for the settle time,
+// the phases on are chopped at a lower duty (TIM2 CH1 - CH4 on PA0 - PA3).
+constexpr static const uint16_t HoldPwmPeriod = Microstepping::PwmPeriod;
+static uint32_t holdSettleTime = 0; // ms
+static uint16_t holdDuty = 0;       // 0: not to reduce
+static volatile bool holding = false;
+static uint32_t standingTicks = 0; // since the last step
+static void enterHold();
+static void leaveHold();
+
+// TIM2 period while standing still
+static uint32_t standingPeriod() {
+  return holding ? HoldPwmPeriod : DwellPeriod;
+}
+
+// the cruise period the main loop asks for (0: as planned), see
+// setCruiseRate(). it is taken at an update event by the step ISR,
+// or at a refill by the DMA sequencer, and the ramp or the jog comes
+// to it from the next interval.
+static PeriodBuffer cruisePeriod;
+static uint32_t stepInterval = 0; // of the step now
+
+// Instrumentation: cruise requests replaced by a later one before they
+// were taken, to be read with a debugger.
+extern "C" {
+volatile uint32_t cruise_requests_coalesced = 0;
+}
+
+static void applyCruise() {
+  ramp.setCruise(cruise);
+  jog.setCruise(cruise);
+  cruise_requests_coalesced = cruisePeriod.coalescedCount();
+}
+
+static void takeCruise() {
+  if (cruisePeriod.take(cruise)) {
+    applyCruise();
+  }
+}
+
+static void setStepInterval(uint32_t ticks) {
+  if (holding) {
+    leaveHold();
+  }
+  standingTicks = 0;
+  stepInterval = ticks;
+  if (isPwmDrive()) {
+    halfStepInterval = ticks;
+  } else {
+    __HAL_TIM_SET_AUTORELOAD(&htim2, ticks - 1);
+  }
+}
+
+// a step of the H-bridges, or of the STEP pulse
+static void driveStep(Rotation r) {
+  int32_t direction = static_cast<int32_t>(r);
+  excitePosition(stepPosition.low() + direction);
+  stepPosition.advance(direction, stepInterval);
+}
+
+static bool useDma() {
+  return DemoSequencer == Sequencer::Dma && !isPwmDrive() &&
+         drive != Drive::StepDir;
+}
+
+static void startDma() {
+  if (holding) {
+    leaveHold();
+  }
+  standingTicks = 0;
+  int8_t direction = static_cast<int8_t>(rotation);
+  switch (drive) {
+  case Drive::Wave:
+    stepDma.start(ramp, WaveByHalfStep, direction);
+    break;
+  case Drive::FullStep:
+    stepDma.start(ramp, FullStepByHalfStep, direction);
+    break;
+  default:
+    stepDma.start(ramp, HalfStepPhases, direction);
+    break;
+  }
+}
+
+// jog: one step at a time toward the target velocity,
+// or standing still while resting.
+static void scheduleJog() {
+  int8_t direction = 0;
+  RampGenerator::Ticks interval = 0;
+  if (jog.next(direction, interval)) {
+    if (direction != static_cast<int8_t>(rotation)) {
+      // only after a rest, so the last step is far behind
+      setRotation(static_cast<Rotation>(direction));
+    }
+    stepsToGo = 1;
+    setStepInterval(interval);
+    return;
+  }
+  stepsToGo = 0;
+  if (jogEnding) {
+    HAL_TIM_Base_Stop_IT(&htim2);
+    stepPosition.standStill();
+    jogging = false;
+    moving = false;
+    return;
+  }
+  if (!isPwmDrive()) {
+    __HAL_TIM_SET_AUTORELOAD(&htim2, standingPeriod() - 1);
+  }
+}
+
+// after a step or a period of standing still (in the ISR):
+// next interval of the ramp, the dwell, or the next segment.
+// The interval running out at the last step of a segment
+// is the one before the first step of the next segment.
+static void chainSegments();
+static void scheduleNext() {
+  if (jogging) {
+    scheduleJog();
+    return;
+  }
+  if (ramp.isRunning()) {
+    setStepInterval(ramp.next());
+    return;
+  }
+  if (stepsToGo != 0) {
+    return; // the last interval is running
+  }
+  chainSegments();
+}
+
+// the next segment, or the dwell, once a segment has run out.
+static void chainSegments() {
+  while (dwellTicks == 0) {
+    if (!loadSegment()) {
+      HAL_TIM_Base_Stop_IT(&htim2);
+      stepPosition.standStill();
+      moving = false;
+      return;
+    }
+    if (stepsToGo != 0) {
+      if (useDma()) {
+        startDma();
+      } else {
+        setStepInterval(ramp.next());
+      }
       return;
     }
   }
-  // clang-format off
-  //
-  if (!(hiloACBD & (ExA << 4))) { HbPinHighA::turnOff(); }
-  if (!(hiloACBD & (ExC << 4))) { HbPinHighC::turnOff(); }
-  if (!(hiloACBD & (ExB << 4))) { HbPinHighB::turnOff(); }
-  if (!(hiloACBD & (ExD << 4))) { HbPinHighD::turnOff(); }
-  if (!(hiloACBD & ExA)) { HbPinLowA::turnOff(); }
-  if (!(hiloACBD & ExC)) { HbPinLowC::turnOff(); }
-  if (!(hiloACBD & ExB)) { HbPinLowB::turnOff(); }
-  if (!(hiloACBD & ExD)) { HbPinLowD::turnOff(); }
-  asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-  asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-  // 10
-  asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-  asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-  // 20
-  //
-  if (hiloACBD & (ExA << 4)) { HbPinHighA::turnOn(); }
-  if (hiloACBD & (ExC << 4)) { HbPinHighC::turnOn(); }
-  if (hiloACBD & (ExB << 4)) { HbPinHighB::turnOn(); }
-  if (hiloACBD & (ExD << 4)) { HbPinHighD::turnOn(); }
-  if (hiloACBD & ExA) { HbPinLowA::turnOn(); }
-  if (hiloACBD & ExC) { HbPinLowC::turnOn(); }
-  if (hiloACBD & ExB) { HbPinLowB::turnOn(); }
-  if (hiloACBD & ExD) { HbPinLowD::turnOn(); }
-  // clang-format on
+  if (!isPwmDrive()) {
+    __HAL_TIM_SET_AUTORELOAD(&htim2, standingPeriod() - 1);
+  }
 }
 
-// short brake = turn ON all lower side switch.
-static inline void shortBrake() { excitingCoil(0b00001111); }
+static void dwell(uint32_t ticks) {
+  dwellTicks = (dwellTicks > ticks) ? dwellTicks - ticks : 0;
+}
 
-//
-enum class Rotation : int8_t { CW = -1, CCW = 1 };
+// a period of standing still in the ISR, the dwell or the rest of the jog
+static void standStill(uint32_t ticks) {
+  dwell(ticks);
+  stepPosition.standStill();
+  if (holding || holdDuty == 0) {
+    return;
+  }
+  standingTicks += ticks;
+  if (standingTicks >= holdSettleTime * (RampGenerator::TimerClock / 1000)) {
+    enterHold();
+  }
+}
 
-// Wave drive (one phase on)
-static inline int32_t waveDrive(int32_t steps, Rotation r) {
-  constexpr static const std::array<ExcitingACBD, 4> pulses{
-      ExA, // A
-      ExB, // B
-      ExC, // C
-      ExD, // D
-  };
-  uint32_t x = (pulses.size() + (steps & 3)) & 3;
-  excitingCoil(fromExcitingACBD(pulses[x]));
-  return steps + static_cast<int32_t>(r);
-}
-
-// Full-step drive (two phases on)
-static inline int32_t fullStepDrive(int32_t steps, Rotation r) {
-  constexpr static const std::array<ExcitingACBD, 4> pulses{
-      ExA | ExB, // AB
-      ExB | ExC, // BC
-      ExC | ExD, // CD
-      ExD | ExA, // DA
-  };
-  uint32_t x = (pulses.size() + (steps & 3)) & 3;
-  excitingCoil(fromExcitingACBD(pulses[x]));
-  return steps + static_cast<int32_t>(r);
+// DMA sequencer played out a segment (in the DMA interrupt).
+static void dmaFinished() {
+  __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+  __HAL_TIM_ENABLE_IT(&htim2, TIM_IT_UPDATE);
+  scheduleNext();
 }
 
-// Half-step drive
-static inline int32_t halfStepDrive(int32_t steps, Rotation r) {
-  constexpr static const std::array<ExcitingACBD, 8> pulses{
-      ExA,       // A
-      ExA | ExB, // AB
-      ExB,       // B
-      ExB | ExC, // BC
-      ExC,       // C
-      ExC | ExD, // CD
-      ExD,       // D
-      ExD | ExA, // DA
-  };
-  uint32_t x = (pulses.size() + (steps & 7)) & 7;
-  excitingCoil(fromExcitingACBD(pulses[x]));
-  return steps + static_cast<int32_t>(r);
+static void microstepUpdate() {
+  if (stepsToGo == 0) {
+    standStill(Microstepping::PwmPeriod);
+    if (dwellTicks == 0) {
+      scheduleNext();
+    }
+    return;
+  }
+  microElapsed += Microstepping::PwmPeriod * Microstepping::PerHalfStep;
+  if (microElapsed < halfStepInterval) {
+    return;
+  }
+  microElapsed -= halfStepInterval;
+  int32_t direction = static_cast<int32_t>(rotation);
+  microIndex += direction;
+  Microstepping::excite(htim2.Instance, microIndex);
+  if (++microSub == Microstepping::PerHalfStep) {
+    microSub = 0;
+    stepPosition.advance(direction, halfStepInterval);
+    stepsToGo = stepsToGo - 1;
+    scheduleNext();
+  }
 }
 
-extern "C" void application_setup() {
-  HAL_Delay(300); // time wait for LCD prepare
-  shortBrake();
-  //
-  i2c_lcd.init();
-  std::string buff(50, ' ');
-  std::snprintf(buff.data(), buff.size(), u8"ｽﾃｯﾋﾟﾝｸﾞﾓｰﾀｰ ﾃｽﾄ");
-  i2c_lcd.setDdramAddress(0);
-  i2c_lcd.putString(buff);
-  //
-  HAL_TIM_Base_Start_IT(&htim2);
+// equalized half-stepping on the PWM period, a half step at a time.
+static void equalizedUpdate() {
+  if (stepsToGo == 0) {
+    standStill(EqualizedHalfStep::PwmPeriod);
+    if (dwellTicks == 0) {
+      scheduleNext();
+    }
+    return;
+  }
+  microElapsed += EqualizedHalfStep::PwmPeriod;
+  if (microElapsed < halfStepInterval) {
+    return;
+  }
+  microElapsed -= halfStepInterval;
+  int32_t direction = static_cast<int32_t>(rotation);
+  stepPosition.advance(direction, halfStepInterval);
+  EqualizedHalfStep::excite(htim2.Instance, stepPosition.low());
+  stepsToGo = stepsToGo - 1;
+  scheduleNext();
+}
+
+// PB1 (TIM2 CH4) pulse output
+static void startPulseOutput() {
   TIM_OC_InitTypeDef sConfigOC = {0};
   sConfigOC.OCMode = TIM_OCMODE_PWM1;
   sConfigOC.Pulse = 1000;
@@ -171,52 +480,440 @@ extern "C" void application_setup() {
   HAL_TIM_PWM_Start(&htim2, TIM_CHANNEL_4);
 }
 
-static volatile int32_t stepCounter = 0;
-static volatile Rotation rotation = Rotation::CW;
+// low side pins are GPIO, or TIM2 CH1 - CH4 outputs for microstepping
+static void configureLowSidePins(uint32_t mode) {
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+  GPIO_InitStruct.Pin = LowA_Pin | LowC_Pin | LowB_Pin | LowD_Pin;
+  GPIO_InitStruct.Mode = mode;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+  GPIO_InitStruct.Alternate = GPIO_AF2_TIM2;
+  HAL_GPIO_Init(LowA_GPIO_Port, &GPIO_InitStruct);
+}
 
-constexpr static const int32_t RightAngle = 400 / 2;
+// a field of each pin in MODER (2 bits) or AFRL (4 bits)
+constexpr uint32_t pinFields(uint32_t pins, uint32_t width, uint32_t value) {
+  uint32_t fields = 0;
+  for (uint32_t i = 0; i < 32 / width; ++i) {
+    if (pins & (1u << i)) {
+      fields |= value << (i * width);
+    }
+  }
+  return fields;
+}
+constexpr static const uint32_t LowSidePins =
+    LowA_Pin | LowC_Pin | LowB_Pin | LowD_Pin;
+constexpr static const uint32_t LowSideModes = pinFields(LowSidePins, 2, 3);
+// STEP pulse of TIM2 CH4, which carries the LowD duty in the PWM drives
+// and while holding
+constexpr static const uint32_t StepPulsePin = GPIO_PIN_1; // PB1
+constexpr static const uint32_t StepPulseMode = pinFields(StepPulsePin, 2, 3);
+
+// PB1 is held low while CH4 carries the LowD duty,
+// and is TIM2 CH4 again for the STEP pulse.
+static void setStepPulsePin(bool pulse) {
+  GPIOB->BRR = StepPulsePin;
+  GPIOB->MODER =
+      (GPIOB->MODER & ~StepPulseMode) |
+      pinFields(StepPulsePin, 2, pulse ? GPIO_MODE_AF_PP : GPIO_MODE_OUTPUT_PP);
+}
+
+// the timer and the pins as the steps left them.
+// both ways are plain register writes, for the step ISR.
+static struct {
+  uint16_t ccmr1;
+  uint16_t ccmr2;
+  uint16_t ccer;
+  std::array<uint16_t, 4> ccr;
+  uint8_t lowSideModes;
+  uint8_t stepPulseMode;
+} beforeHold;
+
+// the phases on keep their switches at holdDuty from the next PWM period.
+static void enterHold() {
+  TIM_TypeDef *tim = htim2.Instance;
+  if (isPwmDrive()) {
+    tim->CCR1 = tim->CCR1 * holdDuty / HoldPwmPeriod;
+    tim->CCR2 = tim->CCR2 * holdDuty / HoldPwmPeriod;
+    tim->CCR3 = tim->CCR3 * holdDuty / HoldPwmPeriod;
+    tim->CCR4 = tim->CCR4 * holdDuty / HoldPwmPeriod;
+    holding = true;
+    return;
+  }
+  uint32_t pins = Hbridge_GPIO_Port->ODR;
+  if (drive == Drive::StepDir || (pins & hbridgePins(0xf0)) == 0) {
+    return; // no current to be held
+  }
+  beforeHold.ccmr1 = tim->CCMR1;
+  beforeHold.ccmr2 = tim->CCMR2;
+  beforeHold.ccer = tim->CCER;
+  beforeHold.ccr = {static_cast<uint16_t>(tim->CCR1),
+                    static_cast<uint16_t>(tim->CCR2),
+                    static_cast<uint16_t>(tim->CCR3),
+                    static_cast<uint16_t>(tim->CCR4)};
+  beforeHold.lowSideModes = LowA_GPIO_Port->MODER & LowSideModes;
+  beforeHold.stepPulseMode = GPIOB->MODER & StepPulseMode;
+  setStepPulsePin(false);
+  // CH1 - CH3 in PWM mode 1 without preload, so the duties apply right now.
+  // CH4 is in PWM mode 1 already, and keeps its bits.
+  tim->CCMR1 = TIM_OCMODE_PWM1 | (TIM_OCMODE_PWM1 << 8);
+  tim->CCMR2 = (tim->CCMR2 & 0xff00) | TIM_OCMODE_PWM1;
+  tim->CCR1 = (pins & LowA_Pin) ? holdDuty : 0;
+  tim->CCR2 = (pins & LowC_Pin) ? holdDuty : 0;
+  tim->CCR3 = (pins & LowB_Pin) ? holdDuty : 0;
+  tim->CCR4 = (pins & LowD_Pin) ? holdDuty : 0;
+  tim->CCER |= TIM_CCER_CC1E | TIM_CCER_CC2E | TIM_CCER_CC3E;
+  __HAL_TIM_SET_AUTORELOAD(&htim2, HoldPwmPeriod - 1);
+  // the low side pins to TIM2 CH1 - CH4 (AF2)
+  LowA_GPIO_Port->AFR[0] = (LowA_GPIO_Port->AFR[0] &
+                            ~pinFields(LowSidePins, 4, 0xf)) |
+                           pinFields(LowSidePins, 4, GPIO_AF2_TIM2);
+  LowA_GPIO_Port->MODER = (LowA_GPIO_Port->MODER & ~LowSideModes) |
+                          pinFields(LowSidePins, 2, GPIO_MODE_AF_PP);
+  holding = true;
+}
+
+// back to the full current before a step.
+// the pattern is still in ODR while the low side pins are chopped.
+static void leaveHold() {
+  holding = false;
+  standingTicks = 0;
+  switch (drive) {
+  case Drive::Microstep:
+    Microstepping::excite(htim2.Instance, microIndex);
+    return;
+  case Drive::EqualizedHalfStep:
+    EqualizedHalfStep::excite(htim2.Instance, stepPosition.low());
+    return;
+  default:
+    break;
+  }
+  TIM_TypeDef *tim = htim2.Instance;
+  LowA_GPIO_Port->MODER =
+      (LowA_GPIO_Port->MODER & ~LowSideModes) | beforeHold.lowSideModes;
+  tim->CCER = beforeHold.ccer;
+  tim->CCMR1 = beforeHold.ccmr1;
+  tim->CCMR2 = beforeHold.ccmr2;
+  tim->CCR1 = beforeHold.ccr[0];
+  tim->CCR2 = beforeHold.ccr[1];
+  tim->CCR3 = beforeHold.ccr[2];
+  tim->CCR4 = beforeHold.ccr[3];
+  GPIOB->MODER = (GPIOB->MODER & ~StepPulseMode) | beforeHold.stepPulseMode;
+}
+
+// after standing still for settleTime (ms), the phases on are chopped at
+// percent of the full current (100: no holding current).
+static void setHoldCurrent(uint32_t settleTime, uint8_t percent) {
+  holdSettleTime = settleTime;
+  holdDuty = (percent < 100) ? HoldPwmPeriod * percent / 100 : 0;
+}
+
+// standing still while stopped (in the main loop)
+static uint32_t stoppedAt = 0;
+
+static void holdWhileStopped() {
+  if (holding || holdDuty == 0) {
+    return;
+  }
+  if (HAL_GetTick() - stoppedAt >= holdSettleTime) {
+    enterHold();
+  }
+}
+
+// wave, full-step and half-step drives switch over at any time,
+// the others only while stopped.
+static void setDrive(Drive d) {
+  if (d == drive) {
+    return;
+  }
+  if (isPatternDrive(d) && isPatternDrive(drive)) {
+    // the step ISR excites the next position in the new drive,
+    // the DMA sequencer from its next segment.
+    if (moving) {
+      drive = d;
+      return;
+    }
+    if (holding) {
+      leaveHold();
+    }
+    drive = d;
+    excitePosition(stepPosition.low());
+    return;
+  }
+  if (moving) {
+    return;
+  }
+  if (holding) {
+    leaveHold();
+  }
+  if (isPwmDrive()) {
+    for (uint32_t ch : {TIM_CHANNEL_1, TIM_CHANNEL_2, TIM_CHANNEL_3}) {
+      HAL_TIM_PWM_Stop(&htim2, ch);
+    }
+    excitingCoil(toPhaseWord(0));
+    configureLowSidePins(GPIO_MODE_OUTPUT_PP);
+    if (DemoSequencer == Sequencer::Dma) {
+      stepDma.configureCompares();
+    }
+    startPulseOutput();
+    setStepPulsePin(true);
+  } else if (drive == Drive::StepDir) {
+    startPulseOutput();
+  }
+  //
+  if (d == Drive::Microstep || d == Drive::EqualizedHalfStep) {
+    excitingCoil(toPhaseWord(0));
+    TIM_OC_InitTypeDef sConfigOC = {0};
+    sConfigOC.OCMode = TIM_OCMODE_PWM1;
+    sConfigOC.Pulse = 0;
+    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+    for (uint32_t ch : {TIM_CHANNEL_1, TIM_CHANNEL_2, TIM_CHANNEL_3,
+                        TIM_CHANNEL_4}) {
+      HAL_TIM_PWM_ConfigChannel(&htim2, &sConfigOC, ch);
+      HAL_TIM_PWM_Start(&htim2, ch);
+    }
+    __HAL_TIM_SET_AUTORELOAD(&htim2, Microstepping::PwmPeriod - 1);
+    htim2.Instance->EGR = TIM_EGR_UG;
+    configureLowSidePins(GPIO_MODE_AF_PP);
+    setStepPulsePin(false);
+    if (d == Drive::Microstep) {
+      microIndex = stepPosition.low() * Microstepping::PerHalfStep;
+      Microstepping::excite(htim2.Instance, microIndex);
+    } else {
+      EqualizedHalfStep::excite(htim2.Instance, stepPosition.low());
+    }
+  } else if (d == Drive::StepDir) {
+    // H-brigdes are left open
+    excitingCoil(toPhaseWord(0));
+    __HAL_RCC_GPIOC_CLK_ENABLE();
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = Dir_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+    HAL_GPIO_Init(Dir_GPIO_Port, &GPIO_InitStruct);
+    // no STEP pulse until a move
+    TIM_OC_InitTypeDef sConfigOC = {0};
+    sConfigOC.OCMode = TIM_OCMODE_PWM1;
+    sConfigOC.Pulse = 0;
+    sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+    sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+    HAL_TIM_PWM_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_4);
+    HAL_TIM_PWM_Start(&htim2, TIM_CHANNEL_4);
+  }
+  drive = d;
+}
+
+extern "C" void application_setup() {
+  HAL_Delay(300); // time wait for LCD prepare
+  shortBrake();
+  //
+  i2c_lcd.init();
+  i2c_lcd.putCells(0, 0, u8"ｽﾃｯﾋﾟﾝｸﾞﾓｰﾀｰ ﾃｽﾄ");
+  i2c_lcd.flushCells();
+  //
+  startPulseOutput();
+  // the DMA sequencer is left out of the build unless it is used
+  if (DemoSequencer == Sequencer::Dma) {
+    stepDma.init();
+  }
+  setDrive(DemoDrive);
+  planner.skipBands().add(ResonanceLow, ResonanceHigh);
+  setHoldCurrent(HoldSettleTime, HoldCurrentPercent);
+}
+
+// starts the queued segments while stopped (in the main loop).
+static void startSegments() {
+  // the ISR is not running, so the first interval takes the cruise here
+  takeCruise();
+  while (stepsToGo == 0 && dwellTicks == 0) {
+    if (!loadSegment()) {
+      return;
+    }
+  }
+  moving = true;
+  if (holding) {
+    leaveHold();
+  }
+  if (isPwmDrive()) {
+    microIndex = stepPosition.low() * Microstepping::PerHalfStep;
+    microSub = 0;
+    microElapsed = 0;
+    if (stepsToGo != 0) {
+      setStepInterval(ramp.next());
+    }
+    __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+    HAL_TIM_Base_Start_IT(&htim2);
+    return;
+  }
+  if (stepsToGo != 0 && useDma()) {
+    startDma();
+    return;
+  }
+  // load the first interval into the shadow register,
+  // then preload the second one so that ARR always runs one step ahead.
+  __HAL_TIM_SET_AUTORELOAD(&htim2,
+                           (stepsToGo != 0 ? ramp.next() : DwellPeriod) - 1);
+  __HAL_TIM_SET_COUNTER(&htim2, 0);
+  if (drive == Drive::StepDir) {
+    // the first period is only the wait for the first step
+    __HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_4, 0);
+  }
+  htim2.Instance->EGR = TIM_EGR_UG;
+  __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+  if (ramp.isRunning()) {
+    setStepInterval(ramp.next());
+  }
+  if (drive == Drive::StepDir && stepsToGo != 0) {
+    __HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_4, StepPulseTicks);
+  }
+  HAL_TIM_Base_Start_IT(&htim2);
+}
+
+// steps/s of the cruise from the next step on, 0: as planned.
+// moved below a skip band as the other speeds are.
+static void setCruiseRate(uint32_t rate) {
+  rate = std::min<uint32_t>({rate, maxDriveRate(), 0xffff});
+  rate = planner.skipBands().below(static_cast<uint16_t>(rate));
+  uint32_t ticks = (rate == 0) ? 0 : RampGenerator::TimerClock / rate;
+  cruisePeriod.request(std::min<uint32_t>(ticks, RampGenerator::MaxInterval));
+}
+
+// new target velocity at any time while jogging,
+// moved below a skip band as a cruise speed of the planner is.
+static void setJogVelocity(int32_t velocity) {
+  uint32_t rate = std::min<uint32_t>(std::abs(velocity), 0xffff);
+  int32_t slower = planner.skipBands().below(static_cast<uint16_t>(rate));
+  jog.setTarget((velocity < 0) ? -slower : slower);
+}
+
+// starts the jog at the velocity while stopped (in the main loop),
+// velocity: steps/s, the sign is the direction (as Rotation)
+static bool startJog(int32_t velocity) {
+  if (moving) {
+    return false;
+  }
+  if (holding) {
+    leaveHold();
+  }
+  jog.setLimits(std::min(MaxStepRate, maxDriveRate()), StepAcceleration);
+  setJogVelocity(velocity);
+  jogEnding = false;
+  jogging = true;
+  moving = true;
+  stepsToGo = 0;
+  dwellTicks = 0;
+  // the first period only rests, then the ISR follows the target.
+  if (isPwmDrive()) {
+    microIndex = stepPosition.low() * Microstepping::PerHalfStep;
+    microSub = 0;
+    microElapsed = 0;
+  } else {
+    __HAL_TIM_SET_AUTORELOAD(&htim2, DwellPeriod - 1);
+    __HAL_TIM_SET_COUNTER(&htim2, 0);
+    if (drive == Drive::StepDir) {
+      __HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_4, 0);
+    }
+    htim2.Instance->EGR = TIM_EGR_UG;
+  }
+  __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+  HAL_TIM_Base_Start_IT(&htim2);
+  return true;
+}
+
+// slows down to stop, then moving turns false.
+static void endJog() {
+  jog.setTarget(0);
+  jogEnding = true;
+}
+
+// 90 degrees in RightAngle steps
+constexpr static const Fixed DegreesPerStep = Fixed::fromRatio(90, RightAngle);
+// half of the last digit shown
+constexpr static const Fixed HalfHundredth = Fixed::fromRatio(1, 200);
+
+// a row of the LCD and its terminator
+using Row = std::array<char, 16 + 1>;
+
+// appends the text at the position in the row, cut at the end of it.
+// returns the position after it.
+static std::size_t putText(Row &row, std::size_t at, const char *s) {
+  while (*s != '\0' && at + 1 < row.size()) {
+    row[at++] = *s++;
+  }
+  return at;
+}
+
+// appends the value in width digits or more, padded on the left.
+// the digits are made here, so that no printf is linked in.
+static std::size_t putNumber(Row &row, std::size_t at, uint32_t value,
+                             std::size_t width, char pad) {
+  std::array<char, 10 + 1> digits{};
+  std::size_t first = digits.size() - 1;
+  do {
+    digits[--first] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (first > 0 && digits.size() - 1 - first < width) {
+    digits[--first] = pad;
+  }
+  return putText(row, at, &digits[first]);
+}
 
 static void showPosition() {
-  std::string buff(50, ' ');
-  int8_t sign = (stepCounter == 0) ? 0 : ((stepCounter < 0) ? (-1) : 1);
+  // a row of the LCD on the stack, no heap in the main loop
+  Row buff{};
+  // position, interval and direction of the same step
+  StepPosition::Snapshot shot = stepPosition.snapshot();
+  int64_t position = shot.position;
+  int8_t sign = (position == 0) ? 0 : ((position < 0) ? (-1) : 1);
+  uint64_t distance = (position < 0) ? 0 - static_cast<uint64_t>(position)
+                                     : static_cast<uint64_t>(position);
+  // the row has no room for more than 32 bits of steps
+  uint32_t steps =
+      static_cast<uint32_t>(std::min<uint64_t>(distance, UINT32_MAX));
+  // whole right angles, then the steps left over in Fixed
+  Fixed leftOver = Fixed::fromInt(static_cast<int32_t>(steps % RightAngle));
+  Fixed degrees = leftOver * DegreesPerStep + HalfHundredth;
+  uint32_t integer = steps / RightAngle * 90 + degrees.integer();
+  uint32_t hundredths = degrees.fraction(100);
+  std::size_t length = 0;
   switch (sign) {
   case 0:
-    std::snprintf(buff.data(), buff.size(), u8" HOME position. ");
+    length = putText(buff, length, u8" HOME position. ");
     break;
   case static_cast<int8_t>(Rotation::CW):
-    std::snprintf(buff.data(), buff.size(), u8"CW %5ld pulses",
-                  std::abs(stepCounter));
+    length = putText(buff, length, u8"CW  ");
     break;
   case static_cast<int8_t>(Rotation::CCW):
-    std::snprintf(buff.data(), buff.size(), u8"CCW %5ld pulses",
-                  std::abs(stepCounter));
+    length = putText(buff, length, u8"CCW ");
     break;
   default:
     break;
   }
-  i2c_lcd.setDdramAddress(0x40);
-  i2c_lcd.putString(buff);
+  if (sign != 0) {
+    // "%4lu.%02lu deg"
+    length = putNumber(buff, length, integer, 4, ' ');
+    length = putText(buff, length, u8".");
+    length = putNumber(buff, length, hundredths, 2, '0');
+    length = putText(buff, length, u8" deg");
+  }
+  // the whole row, so that a shorter line leaves nothing behind
+  std::fill(buff.begin() + length, buff.end() - 1, ' ');
+  // only the digits changed go to the LCD
+  i2c_lcd.putCells(1, 0, buff.data());
+  i2c_lcd.flushCells();
 }
 
-typedef void (*Procedure)();
-
-static void procStopPosition() {
-  showPosition();
-  HAL_Delay(1000);
-  HAL_TIM_Base_Start_IT(&htim2);
-}
-static void procReturnPosition() {
-  rotation = (rotation == Rotation::CW) ? Rotation::CCW : Rotation::CW;
-  showPosition();
-  HAL_Delay(1000);
-  HAL_TIM_Base_Start_IT(&htim2);
-}
+// positions of the demonstration
+enum class Stop : uint8_t { PassBy, Stay, Return };
 
-static Procedure getProcedure(int32_t counter) {
-  switch (std::abs(counter)) {
+static Stop getStop(int32_t position) {
+  switch (std::abs(position)) {
   case 0 * RightAngle: // home position
   case 1 * RightAngle: // 90
-    return procStopPosition;
+    return Stop::Stay;
   case 2 * RightAngle: // 180
   case 3 * RightAngle: // 270
   case 4 * RightAngle: // 360
@@ -225,28 +922,148 @@ static Procedure getProcedure(int32_t counter) {
   case 7 * RightAngle: // 630
   case 8 * RightAngle: // 720
   case 9 * RightAngle: // 810
-    return nullptr;
+    return Stop::PassBy;
   case 10 * RightAngle: // 900
-    return procReturnPosition;
+    return Stop::Return;
   default:
-    return nullptr;
+    return Stop::PassBy;
+  }
+}
+
+constexpr static const uint16_t StopDwell = 1000; // ms
+
+static Rotation planRotation = Rotation::CW;
+
+// plans the demonstration by right angles as far as there is room.
+// the right angles between two stops are passed by at full speed.
+static void planSegments() {
+  for (;;) {
+    int32_t from = planner.plannedPosition();
+    int32_t target = from + RightAngle * static_cast<int32_t>(planRotation);
+    Stop stop = getStop(target);
+    // long runs arrive at the stop from full speed,
+    // S-curve keeps them from overshooting there.
+    bool run = (getStop(from) == Stop::PassBy || stop == Stop::PassBy);
+    RampGenerator::Profile profile = run ? RampGenerator::Profile::SCurve
+                                         : RampGenerator::Profile::Table;
+    auto accel =
+        static_cast<uint16_t>(run ? SCurveAcceleration : StepAcceleration);
+    uint16_t dwell = (stop == Stop::PassBy) ? 0 : StopDwell;
+    if (!planner.plan({target, MaxStepRate, dwell, accel, profile, 0, 0})) {
+      return;
+    }
+    if (stop == Stop::Return) {
+      planRotation =
+          (planRotation == Rotation::CW) ? Rotation::CCW : Rotation::CW;
+    }
+  }
+}
+
+// the right angles back to home cruise at half speed,
+// asked for by the main loop while the motor runs.
+constexpr static const uint32_t HomingCruiseRate = MaxStepRate / 2;
+static uint32_t demoCruiseRate = 0;
+
+static void cruiseDemo() {
+  // back to home: the last step is toward the other side of it
+  StepPosition::Snapshot shot = stepPosition.snapshot();
+  bool homing = (shot.position < 0) ? (shot.direction > 0)
+                                    : (shot.position > 0 && shot.direction < 0);
+  uint32_t rate = homing ? HomingCruiseRate : 0;
+  if (rate != demoCruiseRate) {
+    setCruiseRate(rate);
+    demoCruiseRate = rate;
+  }
+}
+
+// jog demonstration instead of the right angles:
+// full speed CW, reversing to CCW without a stop, then standing still.
+constexpr static const bool DemoJog = false;
+constexpr static const uint32_t JogTurnPeriod = 3000; // ms
+
+static void jogDemo() {
+  uint32_t turn = HAL_GetTick() / JogTurnPeriod % 3;
+  if (turn == 2) {
+    if (jogging && !jogEnding) {
+      endJog();
+    }
+    return;
+  }
+  int32_t velocity = static_cast<int32_t>(MaxStepRate) *
+                     static_cast<int32_t>((turn == 0) ? Rotation::CW
+                                                      : Rotation::CCW);
+  if (!moving) {
+    startJog(velocity);
+  } else if (jog.targetVelocity() != velocity && !jogEnding) {
+    setJogVelocity(velocity);
   }
 }
 
 extern "C" void application_loop() {
-  if (Procedure p = getProcedure(stepCounter); p != nullptr) {
-    (*p)();
+  if (DemoJog) {
+    jogDemo();
   } else {
-    showPosition();
-    HAL_Delay(1);
+    planSegments();
+    cruiseDemo();
+    if (!moving) {
+      startSegments();
+    }
+  }
+  if (moving) {
+    stoppedAt = HAL_GetTick();
+  } else {
+    holdWhileStopped();
+  }
+  showPosition();
+  HAL_Delay(1);
+}
+
+// Instrumentation: TIM2 ticks (= cycles) from the update event to the step
+// handler and spent in it, to be read with a debugger.
+// Compare USE_STEP_ISR_FAST_PATH 1 and 0.
+extern "C" {
+volatile uint16_t step_isr_latency = 0;
+volatile uint16_t step_isr_latency_max = 0;
+volatile uint16_t step_isr_cycles_max = 0;
+}
+
+extern "C" void application_step_timer_update() {
+  uint16_t latency = htim2.Instance->CNT;
+  step_isr_latency = latency;
+  if (latency > step_isr_latency_max) {
+    step_isr_latency_max = latency;
+  }
+  // a new cruise goes to the preload now, and to the timer at the next update
+  takeCruise();
+  //
+  if (drive == Drive::Microstep) {
+    microstepUpdate();
+  } else if (drive == Drive::EqualizedHalfStep) {
+    equalizedUpdate();
+  } else {
+    if (stepsToGo != 0) {
+      driveStep(rotation);
+      stepsToGo = stepsToGo - 1;
+    } else {
+      standStill(standingPeriod());
+    }
+    scheduleNext();
+    if (drive == Drive::StepDir) {
+      // CCR4 is preloaded as ARR is, so this is the pulse of
+      // the next update event, which is a step if any is left.
+      __HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_4,
+                            (stepsToGo != 0) ? StepPulseTicks : 0);
+    }
+  }
+  //
+  uint16_t cycles = htim2.Instance->CNT - latency;
+  if (cycles > step_isr_cycles_max) {
+    step_isr_cycles_max = cycles;
   }
 }
 
 extern "C" void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim) {
   if (htim->Instance == htim2.Instance) {
-    stepCounter = halfStepDrive(stepCounter, rotation);
-    if (getProcedure(stepCounter) != nullptr) {
-      HAL_TIM_Base_Stop_IT(&htim2);
-    }
+    application_step_timer_update();
   }
 }
@@ -0,0 +1,59 @@
+/*
+ * FixedPoint.cpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+#include <FixedPoint.hpp>
+
+// Fixed against double, evaluated by the compiler only:
+// no floating point goes into the image.
+
+constexpr static double real(Fixed x) {
+  return static_cast<double>(x.raw()) / Fixed::One;
+}
+// within lsb (one by default) of the exact value
+constexpr static bool near(Fixed x, double exact, double lsb = 1.0) {
+  double error = x.raw() - exact * Fixed::One;
+  return -lsb <= error && error <= lsb;
+}
+
+constexpr static const Fixed OneAndHalf = Fixed::fromRatio(3, 2);
+constexpr static const Fixed MinusFiveThirds = Fixed::fromRatio(-5, 3);
+constexpr static const Fixed Hundred = Fixed::fromInt(100);
+
+static_assert(near(OneAndHalf, 1.5), "fromRatio");
+static_assert(near(MinusFiveThirds, -5.0 / 3.0), "fromRatio");
+// operations of the operands as they are
+static_assert(near(OneAndHalf * MinusFiveThirds,
+                   real(OneAndHalf) * real(MinusFiveThirds)),
+              "multiply");
+static_assert(near(MinusFiveThirds * MinusFiveThirds,
+                   real(MinusFiveThirds) * real(MinusFiveThirds)),
+              "multiply");
+static_assert(near(Hundred * Fixed::fromRatio(1, 200),
+                   real(Hundred) * real(Fixed::fromRatio(1, 200))),
+              "multiply");
+static_assert(near(Hundred / Fixed::fromInt(7), 100.0 / 7.0), "divide");
+static_assert(near(MinusFiveThirds / OneAndHalf,
+                   real(MinusFiveThirds) / real(OneAndHalf)),
+              "divide");
+static_assert(near(Fixed::fromInt(3).reciprocal(), 1.0 / 3.0), "reciprocal");
+static_assert(near(Fixed::fromInt(2).sqrt(), 1.4142135623730951), "sqrt");
+static_assert(near(Fixed::fromRatio(1, 4).sqrt(), 0.5), "sqrt");
+static_assert(near(Hundred.sqrt(), 10.0), "sqrt");
+static_assert(Fixed::fromInt(-4).sqrt() == Fixed(), "sqrt of negative");
+// out of range
+static_assert((Hundred / Fixed::fromRatio(1, 1000)).raw() == INT32_MAX,
+              "divide saturates");
+static_assert((-Hundred / Fixed::fromRatio(1, 1000)).raw() == INT32_MIN,
+              "divide saturates");
+static_assert((Hundred / Fixed()).raw() == INT32_MAX, "divide by zero");
+// the S-curve of RampGenerator: 3x^2 - 2x^3 at x = 0.3,
+// each of the two products rounds down
+constexpr static const Fixed X = Fixed::fromRatio(3, 10);
+static_assert(near(X * X * (Fixed::fromInt(3) - X - X),
+                   real(X) * real(X) * (3 - 2 * real(X)), 4.0),
+              "smoothstep");
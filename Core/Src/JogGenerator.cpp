@@ -0,0 +1,61 @@
+/*
+ * JogGenerator.cpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+#include <JogGenerator.hpp>
+
+#include <algorithm>
+
+void JogGenerator::setLimits(uint32_t maxRate, uint32_t accel) {
+  // (steps/s)^2 in 32 bits
+  uint32_t fastest =
+      RampGenerator::TimerClock / RampGenerator::MinSquareInterval;
+  maxRate = std::min(std::max(maxRate, SlowestRate), fastest);
+  maxSquare = maxRate * maxRate;
+  twoAccel = 2 * accel;
+}
+
+bool JogGenerator::next(int8_t &direction, Ticks &interval) {
+  int32_t velocity = target.load(std::memory_order_relaxed);
+  int8_t want = (velocity == 0) ? 0 : ((velocity < 0) ? -1 : 1);
+  uint32_t goal = (velocity < 0) ? 0u - static_cast<uint32_t>(velocity)
+                                 : static_cast<uint32_t>(velocity);
+  uint32_t goalSquare =
+      (goal >= 0x10000) ? maxSquare : std::min(goal * goal, maxSquare);
+  goalSquare = std::min(goalSquare, cruiseSquare);
+  const uint32_t slowestSquare = SlowestRate * SlowestRate;
+  if (dir == 0) {
+    if (want == 0) {
+      return false;
+    }
+    // starts from the slowest rate
+    dir = want;
+    square = slowestSquare;
+    rate = SlowestRate;
+  } else if (want == dir && square < goalSquare) {
+    square = std::min(square + twoAccel, goalSquare);
+  } else if (want == dir) {
+    square = std::max(square - std::min(square, twoAccel),
+                      std::max(goalSquare, slowestSquare));
+  } else if (square > slowestSquare) {
+    // slows down to stop or to reverse
+    square = std::max(square - std::min(square, twoAccel), slowestSquare);
+  } else {
+    // rests for a moment at the turn
+    dir = 0;
+    square = 0;
+    rate = 0;
+    return false;
+  }
+  // the speed changes little from step to step,
+  // so one Newton iteration from the last rate is enough for the root.
+  rate = (rate + square / rate) / 2;
+  rate = std::max(rate, SlowestRate);
+  direction = dir;
+  interval = RampGenerator::TimerClock / rate;
+  return true;
+}
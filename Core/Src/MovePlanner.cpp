@@ -0,0 +1,121 @@
+/*
+ * MovePlanner.cpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+#include <MovePlanner.hpp>
+
+#include <FixedPoint.hpp>
+#include <algorithm>
+#include <cstdlib>
+
+// highest speed after s steps from the speed u: sqrt(u^2 + 2as)
+static uint32_t reachable(uint32_t u, uint32_t twoAccel, uint32_t steps) {
+  return isqrt(uint64_t{u} * u + uint64_t{twoAccel} * steps);
+}
+
+// 2a of v^2 = u^2 + 2as,
+// S-curve averages 2/3 of its peak acceleration over a ramp.
+static uint32_t twoAccelOf(const MoveSegment &segment) {
+  return (segment.profile == RampGenerator::Profile::SCurve)
+             ? uint32_t{segment.accel} * 4 / 3
+             : uint32_t{segment.accel} * 2;
+}
+
+bool MovePlanner::plan(const MoveSegment &segment) {
+  commitSettled();
+  if (count == Lookahead && !commitFirst()) {
+    return false;
+  }
+  int32_t distance = segment.target - planned;
+  int8_t direction = (distance == 0) ? 0 : ((distance < 0) ? -1 : 1);
+  Staged &s = window[count++];
+  s.segment = segment;
+  s.segment.peakRate = bands.below(segment.peakRate);
+  if (s.segment.peakRate != segment.peakRate &&
+      segment.profile == RampGenerator::Profile::Table) {
+    // the ramp of table cruises at its own rate
+    s.segment.profile = RampGenerator::Profile::Trapezoidal;
+  }
+  s.steps = std::abs(distance);
+  // ramps of table run from rest to rest.
+  bool table = (s.segment.profile == RampGenerator::Profile::Table);
+  s.maxEntry = 0;
+  if (direction != 0 && direction == lastDirection && lastDwell == 0 &&
+      !table) {
+    s.maxEntry = std::min(lastPeakRate, s.segment.peakRate);
+  }
+  planned = segment.target;
+  lastDirection = table ? 0 : direction;
+  lastPeakRate = s.segment.peakRate;
+  lastDwell = segment.dwell;
+  //
+  recalculate();
+  commitSettled();
+  return true;
+}
+
+void MovePlanner::recalculate() {
+  // backward pass: the window ends standing still.
+  uint32_t exit = 0;
+  for (std::size_t i = count; i-- > 0;) {
+    Staged &s = window[i];
+    s.segment.exitRate = exit;
+    uint32_t twoAccel = twoAccelOf(s.segment);
+    exit = std::min<uint32_t>(s.maxEntry, reachable(exit, twoAccel, s.steps));
+    exit = bands.below(static_cast<uint16_t>(exit));
+  }
+  // forward pass: from the speed the queue leaves off.
+  uint32_t entry = queuedExit;
+  for (std::size_t i = 0; i < count; ++i) {
+    Staged &s = window[i];
+    s.segment.entryRate = entry;
+    uint32_t twoAccel = twoAccelOf(s.segment);
+    entry = std::min<uint32_t>(s.segment.exitRate,
+                               reachable(entry, twoAccel, s.steps));
+    // a lower junction than the reachable one is still reachable,
+    // as the entry is below the band.
+    entry = bands.below(static_cast<uint16_t>(entry));
+    s.segment.exitRate = entry;
+  }
+}
+
+// the segments in front of a stop keep their speeds whatever comes next.
+void MovePlanner::commitSettled() {
+  std::size_t settled = 0;
+  for (std::size_t i = 0; i < count; ++i) {
+    bool stops = (window[i].segment.dwell != 0) ||
+                 (i + 1 < count && window[i + 1].maxEntry == 0);
+    if (stops) {
+      settled = i + 1;
+    }
+  }
+  while (settled != 0 && commitFirst()) {
+    --settled;
+  }
+}
+
+// false: no room in the queue.
+bool MovePlanner::commitFirst() {
+  if (!queue.push(window[0].segment)) {
+    return false;
+  }
+  queuedExit = window[0].segment.exitRate;
+  std::move(window.begin() + 1, window.begin() + count, window.begin());
+  --count;
+  return true;
+}
+
+bool MovePlanner::flush() {
+  while (count != 0) {
+    if (!commitFirst()) {
+      return false;
+    }
+  }
+  // the window has ended at rest, the next segment starts from it.
+  lastDirection = 0;
+  return true;
+}
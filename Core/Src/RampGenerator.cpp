@@ -0,0 +1,218 @@
+/*
+ * RampGenerator.cpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+#include <RampGenerator.hpp>
+
+#include <FixedPoint.hpp>
+
+// smoothstep x^2 (3 - 2x) of x = k / length, scale = 2^31 / length
+static Fixed smoothstep(uint32_t k, uint32_t scale) {
+  // k < length, so that k * scale < 2^31
+  Fixed x = Fixed::fromRaw(static_cast<int32_t>((k * scale) >> 15));
+  return x * x * (Fixed::fromInt(3) - x - x);
+}
+// from + (to - from) * s, 0 <= s <= 1,
+// from two 16 x 32 bit products instead of a 64-bit one.
+static uint32_t blend(uint32_t from, uint32_t to, Fixed s) {
+  uint32_t d = to - from;
+  uint32_t f = static_cast<uint32_t>(s.raw());
+  return from + (d >> 16) * f + (((d & 0xffff) * f) >> 16);
+}
+// 2^31 / length, 0 for no ramp
+static uint32_t scaleOf(uint32_t length) {
+  return (length == 0) ? 0 : (uint32_t{1} << 31) / length;
+}
+// 3 x / d without 3 x overflowing, d below 2^30
+static uint32_t threeTimesOver(uint32_t x, uint32_t d) {
+  return x / d * 3 + x % d * 3 / d;
+}
+// ramp index of a speed: n = v^2 / 2a
+static uint32_t rampIndexOf(uint32_t rate, uint32_t accel) {
+  return rate * rate / (2 * accel);
+}
+
+uint32_t RampGenerator::squareOf(Ticks ticks) {
+  if (ticks == 0) {
+    return UINT32_MAX;
+  }
+  uint32_t v = TimerClock / std::max(ticks, MinSquareInterval);
+  return v * v;
+}
+
+void RampGenerator::setCruise(Ticks ticks) {
+  cruiseTicks = ticks;
+  cruiseSquare = squareOf(ticks);
+  minInterval = std::max(plannedMin, uint32_t{ticks} << FractionBits);
+}
+
+bool RampGenerator::start(uint32_t steps, uint32_t maxRate, uint32_t accel,
+                          Profile p, uint32_t entryRate, uint32_t exitRate) {
+  if (steps == 0 || maxRate == 0 || accel == 0) {
+    remaining = 0;
+    return false;
+  }
+  profile = (p == Profile::SCurve) ? Profile::SCurve : Profile::Trapezoidal;
+  uint32_t cruise = TimerClock / maxRate;
+  Ticks fastest =
+      (profile == Profile::SCurve) ? MinSquareInterval : MinInterval;
+  cruise = (cruise < fastest) ? fastest : cruise;
+  cruise = (cruise > MaxInterval) ? MaxInterval : cruise;
+  plannedMin = cruise << FractionBits;
+  setCruise(cruiseTicks);
+  remaining = steps;
+  // slowest rate the 16-bit timer can make
+  const uint32_t slowest = TimerClock / MaxInterval + 1;
+  // the squares of the speeds at both ends are kept in 32 bits
+  const uint32_t squareRate = TimerClock / MinSquareInterval;
+  entryRate = std::min(entryRate, squareRate);
+  exitRate = std::min(exitRate, squareRate);
+  if (profile == Profile::SCurve) {
+    // ramp length for the peak acceleration of smoothstep (1.5 x average)
+    // s = 3 (V^2 - v0^2) / 4a
+    uint32_t v = TimerClock / cruise;
+    uint32_t v0 = std::max(entryRate, slowest);
+    uint32_t v1 = std::max(exitRate, slowest);
+    uint32_t peak = v * v;
+    uint32_t least = std::max(v0 * v0, v1 * v1);
+    uint32_t up =
+        (peak > v0 * v0) ? threeTimesOver(peak - v0 * v0, 4 * accel) : 0;
+    uint32_t down =
+        (peak > v1 * v1) ? threeTimesOver(peak - v1 * v1, 4 * accel) : 0;
+    if (up > steps || down > steps - up) {
+      // too short to reach the cruise speed
+      // V^2 = (4a s / 3 + v0^2 + v1^2) / 2, below the cruise one,
+      // halved term by term (and their odd halves) to stay in 32 bits
+      uint32_t third = steps % 3 * 4 * accel / 3;
+      peak = steps / 3 * 2 * accel + third / 2 + v0 * v0 / 2 + v1 * v1 / 2 +
+             ((third & 1) + (v0 & 1) + (v1 & 1)) / 2;
+      peak = std::max(peak, least);
+      up = (peak > v0 * v0) ? threeTimesOver(peak - v0 * v0, 4 * accel) : 0;
+      down = (peak > v1 * v1) ? threeTimesOver(peak - v1 * v1, 4 * accel) : 0;
+      // the speeds at both ends cannot be joined at this acceleration,
+      // so the ramps get steeper to fit in the move.
+      up = std::min(up, steps);
+      down = std::min(down, steps - up);
+    }
+    total = steps;
+    upSteps = static_cast<uint16_t>(std::min<uint32_t>(up, 0xffff));
+    downSteps = static_cast<uint16_t>(std::min<uint32_t>(down, 0xffff));
+    upScale = scaleOf(upSteps);
+    downScale = scaleOf(downSteps);
+    // smoothstep changes 1.5 times the average at most
+    uint32_t steepest = 2 * accel;
+    // (over the ramps played, which are 16 bits long)
+    if (upSteps != 0) {
+      steepest =
+          std::max(steepest, threeTimesOver(peak - v0 * v0, 2 * upSteps));
+    }
+    if (downSteps != 0) {
+      steepest =
+          std::max(steepest, threeTimesOver(peak - v1 * v1, 2 * downSteps));
+    }
+    twoAccel = steepest;
+    entrySquare = v0 * v0;
+    exitSquare = v1 * v1;
+    peakSquare = peak;
+    rate = v0;
+    interval = (TimerClock / rate) << FractionBits;
+    return true;
+  }
+  //
+  // c0 = 0.676 * f * sqrt(2 / accel)
+  // sqrt(2 / accel) * 2^16
+  uint32_t root = isqrt(uint64_t{UINT32_MAX / accel} << 1);
+  uint64_t c0 =
+      (uint64_t{TimerClock} * 676 / 1000 * root) >> (16 - FractionBits);
+  uint32_t nFloor = 0;
+  if (c0 > (uint32_t{MaxInterval} << FractionBits)) {
+    // the 16-bit timer cannot wait that long,
+    // so start from the slowest rate the timer can make.
+    nFloor = rampIndexOf(slowest, accel);
+    c0 = uint32_t{MaxInterval} << FractionBits;
+  }
+  n = nFloor;
+  uint32_t first = minInterval;
+  if (entryRate > slowest) {
+    n = rampIndexOf(entryRate, accel);
+    // f / v in 1/256 ticks, from the remainder to stay in 32 bits
+    c0 = (TimerClock / entryRate << FractionBits) +
+         (TimerClock % entryRate << FractionBits) / entryRate;
+    // a faster entry than the cruise asked for slows down from there
+    first = plannedMin;
+  }
+  interval = (c0 < first) ? first : static_cast<uint32_t>(c0);
+  nEnd = nFloor;
+  if (exitRate > slowest) {
+    nEnd = rampIndexOf(exitRate, accel);
+  }
+  return true;
+}
+
+bool RampGenerator::start(uint32_t steps, const Ticks *ramp,
+                          std::size_t length) {
+  if (steps == 0 || length == 0) {
+    remaining = 0;
+    return false;
+  }
+  profile = Profile::Table;
+  table = ramp;
+  tableLast = length - 1;
+  total = steps;
+  remaining = steps;
+  return true;
+}
+
+void RampGenerator::advanceTrapezoidal() {
+  if (n > nEnd && remaining <= n - nEnd) {
+    // deceleration: c[n-1] = c[n] + 2 c[n] / (4n - 1)
+    interval += (2 * interval) / (4 * n - 1);
+    --n;
+    if (interval > (uint32_t{MaxInterval} << FractionBits)) {
+      interval = uint32_t{MaxInterval} << FractionBits;
+    }
+  } else if (interval > minInterval) {
+    // acceleration: c[n+1] = c[n] - 2 c[n] / (4(n+1) + 1)
+    ++n;
+    interval -= (2 * interval) / (4 * n + 1);
+    if (interval < minInterval) {
+      interval = minInterval;
+    }
+  } else if (interval < minInterval && n > nEnd) {
+    // down to a slower cruise, but not below the speed at the end
+    interval += (2 * interval) / (4 * n - 1);
+    --n;
+    if (interval > minInterval) {
+      interval = minInterval;
+    }
+  }
+}
+
+void RampGenerator::advanceSCurve() {
+  uint32_t done = total - remaining;
+  uint32_t left = remaining - 1;
+  uint32_t square = peakSquare;
+  if (done < upSteps) {
+    square = blend(entrySquare, peakSquare, smoothstep(done, upScale));
+  }
+  if (left < downSteps) {
+    square = std::min(
+        square, blend(exitSquare, peakSquare, smoothstep(left, downScale)));
+  }
+  // the cruise asked for, but not below the speed at the end, is reached
+  // and left no faster than the planned ramps change.
+  // (the root below comes short of the square by 2 rate at most)
+  uint32_t now = rate * rate;
+  uint32_t goal = std::max(cruiseSquare, exitSquare);
+  uint32_t faster = now + std::min(twoAccel + 2 * rate, UINT32_MAX - now);
+  uint32_t slower = now - std::min(now, twoAccel);
+  square = std::min(square, std::max(std::min(goal, faster), slower));
+  // the speed changes little from step to step,
+  // so one Newton iteration from the last rate is enough for the root.
+  rate = (rate + square / rate) / 2;
+  interval = (TimerClock / rate) << FractionBits;
+}
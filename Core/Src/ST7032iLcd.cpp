@@ -8,18 +8,13 @@
  */
 #include <ST7032iLcd.hpp>
 
-// clang-format off
-inline void i2c_lcd_wait_a_moment() {
-    asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-    asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-    // 10
-    asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-    asm("NOP");asm("NOP");asm("NOP");asm("NOP");asm("NOP");
-    // 20
-}
-// clang-format on
+#include <algorithm>
+
+// owner of the I2C interrupt
+static ST7032iLcd *lcdTransport = nullptr;
 
 bool ST7032iLcd::init(uint8_t contrast) {
+  lcdTransport = this;
   sendCommands({
       0b00111000, // function set
       0b00111001, // function set
@@ -27,6 +22,7 @@ bool ST7032iLcd::init(uint8_t contrast) {
       0b01101100, // follower control
   });
   setContrast(contrast);
+  flush();
   HAL_Delay(200);
 
   // second step
@@ -35,7 +31,12 @@ bool ST7032iLcd::init(uint8_t contrast) {
       0b00001100, // Display On
       0b00000001, // Clear Display
   });
+  flush();
   HAL_Delay(2);
+  cells.fill(' ');
+  dirtyCells = 0;
+  iconsKnown = false;
+  framesLost = false;
 
   return true;
 }
@@ -65,16 +66,16 @@ static inline bool isHankakuKatakana(uint16_t x) {
           x <= CodePointHankakuKatakanaEnd);
 }
 
-// utf-8 to ascii & sjis kana
-void ST7032iLcd::putString(const std::string &s) {
-  std::array<uint8_t, LCD_NUM_OF_ROW_CHARACTERS> buff;
-  std::size_t buff_idx = 0;
+// utf-8 to ascii & sjis kana, returns the number of codes
+static std::size_t toCharacterCodes(const char *s, std::size_t size,
+                                    uint8_t *codes, std::size_t max) {
+  std::size_t codes_idx = 0;
 
-  for (std::size_t idx = 0; buff_idx < buff.size() && idx < s.size();) {
+  for (std::size_t idx = 0; codes_idx < max && idx < size;) {
     if (Top4bitHigh(s[idx])) {
       // utf8 4-byte encoded character
       // map to '?'
-      buff[buff_idx++] = '?';
+      codes[codes_idx++] = '?';
       idx += 4;
     } else if (Top3bitHigh(s[idx])) {
       // utf8 3-byte encoded character
@@ -84,24 +85,83 @@ void ST7032iLcd::putString(const std::string &s) {
       uint16_t cp = (top4bit << 12) | (mid6bit << 6) | (low6bit << 0);
       if (isHankakuKatakana(cp)) {
         // Hankaku katakana
-        buff[buff_idx++] = 0b10100001 + (cp - CodePointHankakuKatakanaBegin);
+        codes[codes_idx++] = 0b10100001 + (cp - CodePointHankakuKatakanaBegin);
       } else {
         // map to '?'
-        buff[buff_idx++] = '?';
+        codes[codes_idx++] = '?';
       }
       idx += 3;
     } else if (Top2bitHigh(s[idx])) {
       // utf8 2-byte encoded character
       // map to '?'
-      buff[buff_idx++] = '?';
+      codes[codes_idx++] = '?';
       idx += 2;
     } else {
       // utf8 1-byte encoded character
-      buff[buff_idx++] = s[idx];
+      codes[codes_idx++] = s[idx];
       idx += 1;
     }
   }
-  master_transmit(i2c, i2c_address, I2C_LCD_CBYTE_DATA, buff_idx, buff.data());
+  return codes_idx;
+}
+
+void ST7032iLcd::putString(const std::string &s) {
+  std::array<uint8_t, LCD_NUM_OF_ROW_CHARACTERS> buff;
+  std::size_t size =
+      toCharacterCodes(s.data(), s.size(), buff.data(), buff.size());
+  master_transmit(I2C_LCD_CBYTE_DATA, size, buff.data());
+}
+
+void ST7032iLcd::putCells(uint8_t row, uint8_t column, const char *s) {
+  if (row >= LCD_NUM_OF_ROWS || column >= LCD_NUM_OF_ROW_CHARACTERS) {
+    return;
+  }
+  std::array<uint8_t, LCD_NUM_OF_ROW_CHARACTERS> codes;
+  std::size_t size = toCharacterCodes(s, std::strlen(s), codes.data(),
+                                      LCD_NUM_OF_ROW_CHARACTERS - column);
+  std::size_t first = row * LCD_NUM_OF_ROW_CHARACTERS + column;
+  for (std::size_t i = 0; i < size; ++i) {
+    if (cells[first + i] != codes[i]) {
+      cells[first + i] = codes[i];
+      dirtyCells |= uint32_t{1} << (first + i);
+    }
+  }
+}
+
+// a frame was lost in the I2C interrupt, so what the LCD shows is unknown.
+// the caches are dropped here in the main loop, which owns them.
+void ST7032iLcd::forgetLostFrames() {
+  if (framesLost) {
+    framesLost = false;
+    iconsKnown = false;
+    dirtyCells = ~uint32_t{0} >> (32 - cells.size());
+  }
+}
+
+// the runs of dirty cells, each from its own DDRAM address
+void ST7032iLcd::flushCells() {
+  forgetLostFrames();
+  for (uint8_t row = 0; row < LCD_NUM_OF_ROWS; ++row) {
+    uint8_t first = row * LCD_NUM_OF_ROW_CHARACTERS;
+    uint8_t column = 0;
+    while (column < LCD_NUM_OF_ROW_CHARACTERS) {
+      if ((dirtyCells & (uint32_t{1} << (first + column))) == 0) {
+        ++column;
+        continue;
+      }
+      uint8_t begin = column;
+      while (column < LCD_NUM_OF_ROW_CHARACTERS &&
+             (dirtyCells & (uint32_t{1} << (first + column))) != 0) {
+        ++column;
+      }
+      uint8_t addr = row * LCD_ROW_ADDRESS_STEP + begin;
+      transaction()
+          .command(0x80 | (addr & 0x7f)) // set DDRAM address
+          .data(&cells[first + begin], column - begin)
+          .send();
+    }
+  }
+  dirtyCells = 0;
 }
 
 struct Icon {
@@ -131,37 +191,218 @@ static const Icon I2C_LCD_ICON_DATA[13] = {
 };
 
 void ST7032iLcd::showIcon(IconCode bitflag) {
-  std::array<uint8_t, 16> buff{0};
+  std::array<uint8_t, LCD_NUM_OF_ICON_ADDRESSES> buff{0};
 
+  forgetLostFrames();
   for (const Icon &i : I2C_LCD_ICON_DATA) {
     if (bitflag & i.icon_code) {
       buff[i.addr] |= i.bit;
     }
   }
+  // only the addresses changed, each in one frame of commands and data
   for (uint8_t i = 0; i < buff.size(); ++i) {
-    sendCommands({
-        0b00111001,                           // function set
-        static_cast<uint8_t>(0b01000000 | i), // set icon address
-    });
-    sendDatum(buff[i]);
+    if (iconsKnown && iconRam[i] == buff[i]) {
+      continue;
+    }
+    transaction()
+        .command(0b00111001)     // function set
+        .command(0b01000000 | i) // set icon address
+        .datum(buff[i])
+        .send();
+    iconRam[i] = buff[i];
+  }
+  iconsKnown = true;
+}
+
+bool ST7032iLcd::flush(uint32_t timeout) {
+  uint32_t begin = HAL_GetTick();
+  while (isBusy()) {
+    if (HAL_GetTick() - begin >= timeout) {
+      abandonFrame();
+      return false;
+    }
+    kick();
+    __WFI(); // the I2C or any other interrupt wakes up
   }
+  return true;
 }
 
-void ST7032iLcd::master_transmit(I2C_HandleTypeDef &i2c, uint8_t i2c_address,
-                                 CommByte cbyte, size_t size,
+// control byte and data byte pairs are built into the queued frames,
+// so no heap is used while sending.
+void ST7032iLcd::master_transmit(CommByte cbyte, size_t size,
                                  const uint8_t *data) {
-  if (1 <= size) {
+  Frame frame;
+  while (1 <= size) {
+    size_t n = (size < LCD_MAX_FRAME_DATA) ? size : LCD_MAX_FRAME_DATA;
     size_t i;
-    std::vector<uint8_t> buff(size * 2);
+    for (i = 0; i < (n - 1); ++i) {
+      frame.bytes[i * 2 + 0] = I2C_LCD_CBYTE_CONTINUATION | cbyte;
+      frame.bytes[i * 2 + 1] = data[i];
+    }
+    // the last control byte of a frame has no continuation
+    frame.bytes[i * 2 + 0] = cbyte;
+    frame.bytes[i * 2 + 1] = data[i];
+    frame.size = n * 2;
+    queueFrame(frame);
+    data += n;
+    size -= n;
+  }
+}
 
-    for (i = 0; i < (size - 1); ++i) {
-      buff[i * 2 + 0] = I2C_LCD_CBYTE_CONTINUATION | cbyte;
-      buff[i * 2 + 1] = data[i];
+void ST7032iLcd::Transaction::send() {
+  const std::size_t room = Frame().bytes.size();
+  std::size_t begin = 0;
+  while (begin < count) {
+    // the last run of commands or data
+    bool rs = isData(count - 1);
+    std::size_t run = count;
+    while (run > begin && isData(run - 1) == rs) {
+      --run;
     }
-    buff[i * 2 + 0] = cbyte;
-    buff[i * 2 + 1] = data[i];
-    HAL_I2C_Master_Transmit(&i2c, i2c_address << 1, buff.data(), buff.size(),
-                            LCD_TIMEOUT);
-    i2c_lcd_wait_a_moment();
+    Frame frame;
+    std::size_t n = 0;
+    if (2 * (run - begin) + 1 + (count - run) <= room) {
+      for (std::size_t i = begin; i < run; ++i) {
+        frame.bytes[n++] =
+            I2C_LCD_CBYTE_CONTINUATION |
+            (isData(i) ? I2C_LCD_CBYTE_DATA : I2C_LCD_CBYTE_COMMAND);
+        frame.bytes[n++] = bytes[i];
+      }
+      frame.bytes[n++] = rs ? I2C_LCD_CBYTE_DATA : I2C_LCD_CBYTE_COMMAND;
+      for (std::size_t i = run; i < count; ++i) {
+        frame.bytes[n++] = bytes[i];
+      }
+      begin = count;
+    } else {
+      // a frame of pairs, and the rest in the next one
+      std::size_t end = std::min<std::size_t>(count, begin + room / 2);
+      for (std::size_t i = begin; i < end; ++i) {
+        frame.bytes[n++] =
+            ((i + 1 < end) ? I2C_LCD_CBYTE_CONTINUATION : 0) |
+            (isData(i) ? I2C_LCD_CBYTE_DATA : I2C_LCD_CBYTE_COMMAND);
+        frame.bytes[n++] = bytes[i];
+      }
+      begin = end;
+    }
+    frame.size = n;
+    lcd.queueFrame(frame);
+  }
+  count = 0;
+  dataBits = 0;
+}
+
+void ST7032iLcd::queueFrame(const Frame &frame) {
+  uint32_t begin = HAL_GetTick();
+  while (!queue.push(frame)) {
+    // full: sleep until a frame has gone, as long as a frame may take
+    if (HAL_GetTick() - begin >= LCD_TIMEOUT) {
+      abandonFrame();
+      begin = HAL_GetTick();
+      continue;
+    }
+    kick();
+    __WFI();
+  }
+  kick();
+}
+
+// the frame on the bus has not gone in LCD_TIMEOUT: the bus is stuck.
+// it is lost, and the I2C is reset so that the frames after it go.
+void ST7032iLcd::abandonFrame() {
+  HAL_NVIC_DisableIRQ(I2C1_IRQn);
+  if (sending) {
+    resetBus();
+    queue.pop();
+    errors = errors + 1;
+    framesLost = true;
+    startNext();
+  }
+  HAL_NVIC_EnableIRQ(I2C1_IRQn);
+}
+
+// clearing PE releases the lines and clears the flags of the transfer
+void ST7032iLcd::resetBus() {
+  I2C_TypeDef *regs = i2c.Instance;
+  regs->CR1 &= ~(I2C_CR1_PE | I2C_CR1_TXIE | I2C_CR1_STOPIE |
+                 I2C_CR1_NACKIE | I2C_CR1_ERRIE);
+  regs->CR1 |= I2C_CR1_PE;
+}
+
+// starts sending from the main loop if the bus is idle.
+// the I2C interrupt is held off, so that the queue is popped
+// by one side at a time.
+void ST7032iLcd::kick() {
+  HAL_NVIC_DisableIRQ(I2C1_IRQn);
+  if (!sending) {
+    startNext();
+  }
+  HAL_NVIC_EnableIRQ(I2C1_IRQn);
+}
+
+// the write ends with a STOP after the last byte (AUTOEND),
+// or after a NACK, and then STOPF calls transmitted().
+void ST7032iLcd::startNext() {
+  const Frame *frame = queue.front();
+  sending = (frame != nullptr);
+  if (frame == nullptr) {
+    return;
+  }
+  I2C_TypeDef *regs = i2c.Instance;
+  bytesSent = 0;
+  nacked = false;
+  regs->ISR = I2C_ISR_TXE; // flushes a byte left by a NACK
+  regs->ICR = I2C_ICR_NACKCF | I2C_ICR_STOPCF | I2C_ICR_BERRCF |
+              I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+  regs->CR1 |= I2C_CR1_TXIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+  regs->CR2 = ((i2c_address << 1) & I2C_CR2_SADD) |
+              (uint32_t{frame->size} << I2C_CR2_NBYTES_Pos) |
+              I2C_CR2_AUTOEND | I2C_CR2_START;
+}
+
+// a frame has gone or failed (in the I2C interrupt)
+void ST7032iLcd::transmitted(bool ok) {
+  queue.pop();
+  if (!ok) {
+    errors = errors + 1;
+    framesLost = true;
+  }
+  if (onSent != nullptr) {
+    onSent();
+  }
+  startNext();
+}
+
+void ST7032iLcd::interrupt() {
+  I2C_TypeDef *regs = i2c.Instance;
+  uint32_t flags = regs->ISR;
+  const Frame *frame = queue.front();
+  if (!sending || frame == nullptr) {
+    resetBus();
+    return;
+  }
+  if (flags & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR)) {
+    // the bus is lost, no STOP follows
+    resetBus();
+    transmitted(false);
+    return;
+  }
+  if (flags & I2C_ISR_NACKF) {
+    regs->ICR = I2C_ICR_NACKCF;
+    nacked = true;
+  }
+  if ((flags & I2C_ISR_TXIS) && bytesSent < frame->size) {
+    regs->TXDR = frame->bytes[bytesSent++];
+  }
+  if (flags & I2C_ISR_STOPF) {
+    regs->ICR = I2C_ICR_STOPCF;
+    regs->CR1 &= ~(I2C_CR1_TXIE | I2C_CR1_STOPIE | I2C_CR1_NACKIE |
+                   I2C_CR1_ERRIE);
+    transmitted(!nacked);
+  }
+}
+
+extern "C" void lcd_i2c_interrupt() {
+  if (lcdTransport != nullptr) {
+    lcdTransport->interrupt();
   }
 }
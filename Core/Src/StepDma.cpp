@@ -0,0 +1,166 @@
+/*
+ * StepDma.cpp
+ *
+ * Copyright 2021 Akihiro Yamamoto.
+ * Licensed under the Apache License, Version 2.0
+ * <https://spdx.org/licenses/Apache-2.0.html>
+ *
+ */
+#include <StepDma.hpp>
+
+// DMA1 channels of TIM2 (request 8), programmed by the registers,
+// so that no HAL handle takes RAM for them.
+static DMA_Channel_TypeDef *const PeriodChannel = DMA1_Channel2; // TIM2_UP
+static DMA_Channel_TypeDef *const OffChannel = DMA1_Channel5;    // TIM2_CH1
+static DMA_Channel_TypeDef *const OnChannel = DMA1_Channel3;     // TIM2_CH2
+// circular, half words from memory to words of peripheral, very high
+constexpr static const uint32_t ChannelMode = DMA_CCR_DIR | DMA_CCR_CIRC |
+                                              DMA_CCR_MINC | DMA_CCR_PSIZE_1 |
+                                              DMA_CCR_MSIZE_0 | DMA_CCR_PL;
+
+// owner of the DMA interrupt
+static StepDma *dmaSequencer = nullptr;
+
+static void startChannel(DMA_Channel_TypeDef *channel, const uint16_t *from,
+                         volatile uint32_t *to, uint16_t count,
+                         uint32_t interrupts) {
+  channel->CCR = 0;
+  channel->CNDTR = count;
+  channel->CPAR = reinterpret_cast<uintptr_t>(to);
+  channel->CMAR = reinterpret_cast<uintptr_t>(from);
+  channel->CCR = ChannelMode | interrupts | DMA_CCR_EN;
+}
+
+void StepDma::init() {
+  dmaSequencer = this;
+  __HAL_RCC_DMA1_CLK_ENABLE();
+  constexpr uint32_t selections = DMA_CSELR_C2S | DMA_CSELR_C3S | DMA_CSELR_C5S;
+  constexpr uint32_t tim2 = (DMA_REQUEST_8 << DMA_CSELR_C2S_Pos) |
+                            (DMA_REQUEST_8 << DMA_CSELR_C3S_Pos) |
+                            (DMA_REQUEST_8 << DMA_CSELR_C5S_Pos);
+  DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~selections) | tim2;
+  HAL_NVIC_SetPriority(DMA1_Channel2_3_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+  configureCompares();
+}
+
+void StepDma::configureCompares() {
+  TIM_OC_InitTypeDef sConfigOC = {0};
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = OffCompare;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  HAL_TIM_OC_ConfigChannel(&htim, &sConfigOC, TIM_CHANNEL_1);
+  sConfigOC.Pulse = OnCompare;
+  HAL_TIM_OC_ConfigChannel(&htim, &sConfigOC, TIM_CHANNEL_2);
+}
+
+bool StepDma::start(RampGenerator &r, const PhaseWord *table, uint8_t mask,
+                    int8_t direction) {
+  if (running || !r.isRunning()) {
+    return false;
+  }
+  ramp = &r;
+  phases = table;
+  phaseMask = mask;
+  step = direction;
+  // the position is the pattern excited now
+  phaseIndex = position.low() + direction;
+  toFill = r.remainingSteps();
+  stepsToGo = toFill;
+  lastOnPins = Hbridge_GPIO_Port->ODR & HbridgeAllPins;
+  //
+  // the first period is loaded right now and the second one is preloaded,
+  // so that the update DMA writes the third one at the end of the first.
+  __HAL_TIM_DISABLE_IT(&htim, TIM_IT_UPDATE);
+  __HAL_TIM_SET_AUTORELOAD(&htim, r.next() - 1);
+  htim.Instance->EGR = TIM_EGR_UG;
+  lastPeriod = htim.Instance->ARR;
+  if (r.isRunning()) {
+    lastPeriod = r.next() - 1;
+    __HAL_TIM_SET_AUTORELOAD(&htim, lastPeriod);
+  }
+  fill(0);
+  fill(HalfSteps);
+  //
+  running = true;
+  DMA1->IFCR = DMA_IFCR_CGIF3;
+  startChannel(PeriodChannel, periods.data(), &htim.Instance->ARR, BufferSteps,
+               0);
+  startChannel(OffChannel, offPins.data(), &Hbridge_GPIO_Port->BRR,
+               BufferSteps, 0);
+  startChannel(OnChannel, onPins.data(), &Hbridge_GPIO_Port->BSRR, BufferSteps,
+               DMA_CCR_HTIE | DMA_CCR_TCIE);
+  // first period has no step: begin behind both of the compares.
+  __HAL_TIM_SET_COUNTER(&htim, OnCompare + 1);
+  __HAL_TIM_CLEAR_FLAG(&htim, TIM_FLAG_UPDATE | TIM_FLAG_CC1 | TIM_FLAG_CC2);
+  __HAL_TIM_ENABLE_DMA(&htim, TIM_DMA_UPDATE | TIM_DMA_CC1 | TIM_DMA_CC2);
+  __HAL_TIM_ENABLE(&htim);
+  return true;
+}
+
+void StepDma::stop() {
+  __HAL_TIM_DISABLE_DMA(&htim, TIM_DMA_UPDATE | TIM_DMA_CC1 | TIM_DMA_CC2);
+  PeriodChannel->CCR = 0;
+  OffChannel->CCR = 0;
+  OnChannel->CCR = 0;
+  DMA1->IFCR = DMA_IFCR_CGIF3;
+  stepsToGo = 0;
+  running = false;
+}
+
+void StepDma::fill(std::size_t begin) {
+  for (std::size_t i = begin; i < begin + HalfSteps; ++i) {
+    if (toFill != 0) {
+      const PhaseWord &w = phases[phaseIndex & phaseMask];
+      offPins[i] = w.off >> 16;
+      onPins[i] = w.on;
+      lastOnPins = w.on;
+      phaseIndex += step;
+      --toFill;
+    } else {
+      // hold the last pattern until stopped
+      offPins[i] = 0;
+      onPins[i] = lastOnPins;
+    }
+    if (ramp->isRunning()) {
+      lastPeriod = ramp->next() - 1;
+    }
+    periods[i] = lastPeriod;
+  }
+}
+
+void StepDma::completed(std::size_t begin) {
+  uint32_t done = (stepsToGo < HalfSteps) ? stepsToGo : HalfSteps;
+  position.advance(step * static_cast<int32_t>(done), lastPeriod + 1u);
+  stepsToGo = stepsToGo - done;
+  if (stepsToGo == 0) {
+    stop();
+    if (onFinished != nullptr) {
+      onFinished();
+    }
+  } else {
+    if (onRefilling != nullptr) {
+      onRefilling();
+    }
+    fill(begin);
+  }
+}
+
+void StepDma::interrupt() {
+  uint32_t flags = DMA1->ISR;
+  if (running && (flags & DMA_ISR_HTIF3)) {
+    DMA1->IFCR = DMA_IFCR_CHTIF3;
+    completed(0);
+  }
+  if (running && (flags & DMA_ISR_TCIF3)) {
+    DMA1->IFCR = DMA_IFCR_CTCIF3;
+    completed(HalfSteps);
+  }
+}
+
+extern "C" void step_dma_interrupt() {
+  if (dmaSequencer != nullptr) {
+    dmaSequencer->interrupt();
+  }
+}
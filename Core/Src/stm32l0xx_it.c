@@ -48,6 +48,10 @@
 /* Private function prototypes -----------------------------------------------*/
 /* USER CODE BEGIN PFP */
 
+extern void application_step_timer_update();
+extern void step_dma_interrupt();
+extern void lcd_i2c_interrupt();
+
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -147,7 +151,16 @@ void SysTick_Handler(void)
 void TIM2_IRQHandler(void)
 {
   /* USER CODE BEGIN TIM2_IRQn 0 */
-
+#if USE_STEP_ISR_FAST_PATH
+  /* The update is the only interrupt enabled on TIM2,
+   * so skip testing every flag in HAL_TIM_IRQHandler(). */
+  if (__HAL_TIM_GET_FLAG(&htim2, TIM_FLAG_UPDATE) != RESET)
+  {
+    __HAL_TIM_CLEAR_FLAG(&htim2, TIM_FLAG_UPDATE);
+    application_step_timer_update();
+  }
+  return;
+#endif
   /* USER CODE END TIM2_IRQn 0 */
   HAL_TIM_IRQHandler(&htim2);
   /* USER CODE BEGIN TIM2_IRQn 1 */
@@ -157,5 +170,21 @@ void TIM2_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles DMA1 channel 2 and channel 3 interrupts.
+  */
+void DMA1_Channel2_3_IRQHandler(void)
+{
+  step_dma_interrupt();
+}
+
+/**
+  * @brief This function handles I2C1 event and error interrupts.
+  */
+void I2C1_IRQHandler(void)
+{
+  lcd_i2c_interrupt();
+}
+
 /* USER CODE END 1 */
 